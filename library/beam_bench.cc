@@ -0,0 +1,161 @@
+// benchmark for searn beam search: trains --searn_task sequence on
+// synthetic tag sequences from a random Markov chain, then decodes held out
+// sequences greedily, exactly with viterbi and with each beam size,
+// reporting sequences per second and the per-token error of each.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <boost/program_options.hpp>
+
+#include "../vowpalwabbit/vw.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+int sequences = 500;
+int test_sequences = 200;
+int length = 20;
+int labels = 10;
+int features = 10;
+int vocabulary = 1000;
+int passes = 2;
+int seed = 1;
+string prefix = "beam_bench";
+string vwparams;
+
+double now()
+{
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+double uniform()
+{
+        return rand() / (RAND_MAX + 1.0);
+}
+
+// a tag sequence from a sticky random Markov chain; half of the features of
+// a token are drawn from its tag's part of the vocabulary, the rest are noise
+void write_sequences(const string& filename, int n, const vector<vector<float> >& transition)
+{
+        ofstream out(filename.c_str());
+        int slice = vocabulary / labels;
+        for (int s = 0; s < n; s++)
+        {
+                int tag = rand() % labels;
+                for (int t = 0; t < length; t++)
+                {
+                        double r = uniform();
+                        int next = 0;
+                        while (next < labels - 1 && (r -= transition[tag][next]) > 0)
+                                next++;
+                        tag = next;
+                        out << tag + 1 << " |w";
+                        for (int j = 0; j < features; j++)
+                                out << " " << ((uniform() < 0.5) ? tag * slice + rand() % slice : rand() % vocabulary);
+                        out << "\n";
+                }
+                out << "\n";
+        }
+}
+
+// runs vw over a data file the way the command line does
+void run(const string& params, double& seconds, double& loss_per_token)
+{
+        vw* model = VW::initialize(params);
+        double start = now();
+        VW::start_parser(*model, false);
+        model->l->driver(model);
+        VW::end_parser(*model);
+        seconds = now() - start;
+        loss_per_token = model->sd->sum_loss / ((double)model->sd->weighted_examples * length);
+        VW::finish(*model);
+}
+
+int main(int argc, char *argv[])
+{
+        vector<int> beams;
+        po::variables_map vm;
+        po::options_description desc("Allowed options");
+        desc.add_options()
+                ("help,h", "produce help message")
+                ("beam,B", po::value<vector<int> >(&beams), "beam sizes to benchmark (default 1, 2, 4, 8, 16, 32 and 64)")
+                ("sequences,n", po::value<int>(&sequences), "number of training sequences")
+                ("test_sequences", po::value<int>(&test_sequences), "number of sequences to decode")
+                ("length,l", po::value<int>(&length), "tokens per sequence")
+                ("labels,k", po::value<int>(&labels), "number of tags")
+                ("features,f", po::value<int>(&features), "features per token")
+                ("vocabulary", po::value<int>(&vocabulary), "number of distinct features")
+                ("passes", po::value<int>(&passes), "training passes")
+                ("seed", po::value<int>(&seed), "seed for the synthetic data")
+                ("prefix", po::value<string>(&prefix), "prefix of the data, cache and model files written")
+                ("vwparams", po::value<string>(&vwparams), "further vw parameters for training")
+                ;
+
+        try {
+                po::store(po::parse_command_line(argc, argv, desc), vm);
+                po::notify(vm);
+        }
+        catch(exception & e)
+        {
+                cout << endl << argv[0] << ": " << e.what() << endl << endl << desc << endl;
+                exit(2);
+        }
+
+        if (vm.count("help") || labels < 2 || vocabulary < labels) {
+                cout << desc << "\n";
+                return 1;
+        }
+        if (beams.empty())
+                for (int b = 1; b <= 64; b *= 2)
+                        beams.push_back(b);
+
+        srand(seed);
+        vector<vector<float> > transition(labels, vector<float>(labels));
+        for (int i = 0; i < labels; i++)
+        {
+                float total = 0.f;
+                for (int j = 0; j < labels; j++)
+                        total += transition[i][j] = (float)uniform() + (i == j ? labels / 2.f : 0.f);
+                for (int j = 0; j < labels; j++)
+                        transition[i][j] /= total;
+        }
+        string train = prefix + ".train", test = prefix + ".test", cache = prefix + ".cache", model = prefix + ".model";
+        write_sequences(train, sequences, transition);
+        write_sequences(test, test_sequences, transition);
+
+        double seconds, loss;
+        ostringstream params;
+        params << "--quiet -b 20 --searn " << labels << " --searn_task sequence --searn_history 1 --searn_bigrams"
+               << " -d " << train << " -k --cache_file " << cache << " --passes " << passes << " --holdout_off"
+               << " -f " << model << " " << vwparams;
+        run(params.str(), seconds, loss);
+        fprintf(stderr, "train          %8.1f sequences/s\n", sequences * passes / seconds);
+
+        ostringstream decode_params;
+        decode_params << "--quiet -t --searn " << labels << " --searn_task sequence -i " << model << " -d " << test;
+        string decode = decode_params.str();
+        run(decode, seconds, loss);
+        fprintf(stderr, "greedy         %8.1f sequences/s, error %f\n", test_sequences / seconds, loss);
+        run(decode + " --searn_viterbi", seconds, loss);
+        fprintf(stderr, "viterbi        %8.1f sequences/s, error %f\n", test_sequences / seconds, loss);
+        for (size_t i = 0; i < beams.size(); i++)
+        {
+                ostringstream beam;
+                beam << decode << " --searn_beam " << beams[i];
+                run(beam.str(), seconds, loss);
+                fprintf(stderr, "beam %3d       %8.1f sequences/s, error %f\n", beams[i], test_sequences / seconds, loss);
+        }
+
+        remove(train.c_str());
+        remove(test.c_str());
+        remove(cache.c_str());
+        remove(model.c_str());
+        exit(EXIT_SUCCESS);
+}
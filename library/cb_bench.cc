@@ -0,0 +1,148 @@
+// benchmark for contextual bandit learning: trains --cb k on synthetic
+// bandit feedback for a linear k-class problem and reports examples per
+// second of training, then of prediction, for each k.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <boost/program_options.hpp>
+
+#include "../vowpalwabbit/vw.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+int examples = 20000;
+int features = 20;
+int vocabulary = 1000;
+int seed = 1;
+string cb_type = "dr";
+string vwparams;
+
+double now()
+{
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+double uniform()
+{
+        return rand() / (RAND_MAX + 1.0);
+}
+
+// parses line, which read_example wants writable
+example* read(vw& model, const string& line)
+{
+        vector<char> buffer(line.begin(), line.end());
+        buffer.push_back(0);
+        return VW::read_example(model, &buffer[0]);
+}
+
+// the features of an example and its best action under hidden weights
+string context(int k, const vector<float>& truth, int& best)
+{
+        ostringstream ss;
+        vector<float> score(k, 0.f);
+        ss << "|f";
+        for (int j = 0; j < features; j++)
+        {
+                int f = rand() % vocabulary;
+                ss << " " << f;
+                for (int a = 0; a < k; a++)
+                        score[a] += truth[f * k + a];
+        }
+        best = 0;
+        for (int a = 1; a < k; a++)
+                if (score[a] > score[best])
+                        best = a;
+        return ss.str();
+}
+
+void bench(int k)
+{
+        srand(seed);
+        vector<float> truth(vocabulary * k);
+        for (size_t j = 0; j < truth.size(); j++) truth[j] = (float)(2 * uniform() - 1);
+
+        ostringstream params;
+        params << "--quiet -b 20 --cb " << k << " --cb_type " << cb_type << " " << vwparams;
+        vw* model = VW::initialize(params.str());
+
+        // uniformly logged actions, cost 0 for the best one and 1 otherwise
+        char label[64];
+        int best;
+        double start = now();
+        for (int n = 0; n < examples; n++)
+        {
+                string features = context(k, truth, best);
+                int action = rand() % k;
+                sprintf(label, "%d:%d:%f ", action + 1, action == best ? 0 : 1, 1.f / k);
+                example *ex = read(*model, label + features);
+                model->learn(ex);
+                VW::finish_example(*model, ex);
+        }
+        double train_time = now() - start;
+
+        int errors = 0;
+        start = now();
+        for (int n = 0; n < examples; n++)
+        {
+                string features = context(k, truth, best);
+                example *ex = read(*model, features);
+                model->learn(ex);
+                if ((int)ex->final_prediction != best + 1)
+                        errors++;
+                VW::finish_example(*model, ex);
+        }
+        double test_time = now() - start;
+
+        fprintf(stderr, "cb_type %s k %3d: train %8.0f examples/s, predict %8.0f examples/s, error %f\n",
+                cb_type.c_str(), k, examples / train_time, examples / test_time, (double)errors / examples);
+
+        VW::finish(*model);
+}
+
+int main(int argc, char *argv[])
+{
+        vector<int> actions;
+        po::variables_map vm;
+        po::options_description desc("Allowed options");
+        desc.add_options()
+                ("help,h", "produce help message")
+                ("actions,k", po::value<vector<int> >(&actions), "numbers of actions to benchmark (default 2, 10 and 100)")
+                ("examples,n", po::value<int>(&examples), "number of training and of test examples")
+                ("features,f", po::value<int>(&features), "features per example")
+                ("vocabulary", po::value<int>(&vocabulary), "number of distinct features")
+                ("cb_type", po::value<string>(&cb_type), "contextual bandit method, as for vw")
+                ("seed", po::value<int>(&seed), "seed for the synthetic data")
+                ("vwparams", po::value<string>(&vwparams), "further vw parameters")
+                ;
+
+        try {
+                po::store(po::parse_command_line(argc, argv, desc), vm);
+                po::notify(vm);
+        }
+        catch(exception & e)
+        {
+                cout << endl << argv[0] << ": " << e.what() << endl << endl << desc << endl;
+                exit(2);
+        }
+
+        if (vm.count("help")) {
+                cout << desc << "\n";
+                return 1;
+        }
+        if (actions.empty()) {
+                actions.push_back(2);
+                actions.push_back(10);
+                actions.push_back(100);
+        }
+
+        for (size_t i = 0; i < actions.size(); i++)
+                bench(actions[i]);
+        exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,155 @@
+// topic inference against the topics written by vw --lda ... --lda_topics,
+// on several threads sharing one mapped copy of them.  vw is only used to
+// parse and hash the documents.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <boost/program_options.hpp>
+
+#include "../vowpalwabbit/vw.h"
+#include "../vowpalwabbit/lda_core.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+int threads = 1;
+string topicsfilename;
+string datafilename;
+string predictionsfilename;
+string vwparams;
+
+struct document {
+        vector<feature> features;
+        string tag;
+};
+
+struct worker {
+        pthread_t thread;
+        const LDA::topics* topics;
+        const vector<document>* documents;
+        vector<float>* gammas;
+        size_t id;
+        LDA::infer_stats stats;
+        LDA::infer_buffers buffers;
+};
+
+void* infer_documents(void* arg)
+{
+        worker& w = *(worker*)arg;
+        size_t K = LDA::num_topics(*w.topics);
+        const vector<document>& documents = *w.documents;
+        for (size_t d = w.id; d < documents.size(); d += threads)
+        {
+                const feature* begin = documents[d].features.size() > 0 ? &documents[d].features[0] : NULL;
+                LDA::infer(*w.topics, begin, begin + documents[d].features.size(), &(*w.gammas)[d * K], w.buffers, &w.stats);
+        }
+        return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+        po::variables_map vm;
+        po::options_description desc("Allowed options");
+        desc.add_options()
+                ("help,h", "produce help message")
+                ("topics,T", po::value<string>(&topicsfilename), "topics written by vw --lda_topics")
+                ("data,d", po::value<string>(&datafilename), "documents in vw format")
+                ("predictions,p", po::value<string>(&predictionsfilename), "file to write the topic weights of each document to")
+                ("threads,t", po::value<int>(&threads), "number of threads")
+                ("vwparams", po::value<string>(&vwparams), "vw parameters that hash features as the model did (--lda <k> -b <bits> ...)")
+                ;
+
+        try {
+                po::store(po::parse_command_line(argc, argv, desc), vm);
+                po::notify(vm);
+        }
+        catch(exception & e)
+        {
+                cout << endl << argv[0] << ": " << e.what() << endl << endl << desc << endl;
+                exit(2);
+        }
+
+        if (vm.count("help") || topicsfilename.empty() || datafilename.empty() || vwparams.empty() || threads <= 0)
+        {
+                cout << desc << "\n";
+                cout << "Example usage:" << endl;
+                cout << "    ./lda_infer -T wiki.topics -d docs -t 8 --vwparams '--lda 100 -b 13'" << endl;
+                exit(2);
+        }
+
+        LDA::topics* topics = LDA::open_topics(topicsfilename.c_str());
+        size_t K = LDA::num_topics(*topics);
+
+        vw* model = VW::initialize(vwparams + " -t --quiet");
+        FILE* file = fopen(datafilename.c_str(), "r");
+        if (file == NULL)
+        {
+                fprintf(stderr, "can't open %s: %s\n", datafilename.c_str(), strerror(errno));
+                exit(2);
+        }
+        vector<document> documents;
+        char* line = NULL;
+        size_t len = 0;
+        ssize_t read;
+        while ((read = getline(&line, &len, file)) != -1)
+        {
+                if (read > 0 && line[read-1] == '\n')
+                        line[read-1] = 0;
+                example* ec = VW::read_example(*model, line);
+                document doc;
+                for (unsigned char* i = ec->indices.begin; i != ec->indices.end; i++)
+                        doc.features.insert(doc.features.end(), ec->atomics[*i].begin, ec->atomics[*i].end);
+                doc.tag.assign(ec->tag.begin, ec->tag.end);
+                documents.push_back(doc);
+                VW::finish_example(*model, ec);
+        }
+        free(line);
+        fclose(file);
+
+        vector<float> gammas(documents.size() * K);
+        vector<worker> workers(threads);
+        for (int t = 0; t < threads; t++)
+        {
+                worker& w = workers[t];
+                memset(&w.stats, 0, sizeof(w.stats));
+                w.topics = topics;
+                w.documents = &documents;
+                w.gammas = &gammas;
+                w.id = t;
+                pthread_create(&w.thread, NULL, infer_documents, &w);
+        }
+        LDA::infer_stats stats;
+        memset(&stats, 0, sizeof(stats));
+        for (int t = 0; t < threads; t++)
+        {
+                pthread_join(workers[t].thread, NULL);
+                LDA::merge_stats(stats, workers[t].stats);
+        }
+        LDA::print_stats(cerr, stats);
+
+        if (!predictionsfilename.empty())
+        {
+                FILE* out = fopen(predictionsfilename.c_str(), "w");
+                if (out == NULL)
+                {
+                        fprintf(stderr, "can't open %s: %s\n", predictionsfilename.c_str(), strerror(errno));
+                        exit(2);
+                }
+                for (size_t d = 0; d < documents.size(); d++)
+                {
+                        for (size_t k = 0; k < K; k++)
+                                fprintf(out, "%f ", gammas[d * K + k]);
+                        fprintf(out, "%s\n", documents[d].tag.c_str());
+                }
+                fclose(out);
+        }
+
+        VW::finish(*model);
+        LDA::close_topics(topics);
+        exit(EXIT_SUCCESS);
+}
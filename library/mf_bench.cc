@@ -0,0 +1,152 @@
+// benchmark for matrix factorization: trains a rank --rank model on
+// synthetic user/item ratings, then scores every user x item pair the way
+// recommend does (parse "|u user |i item", predict, keep a top k heap).
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <vector>
+#include <queue>
+#include <utility>
+#include <iostream>
+#include <boost/program_options.hpp>
+
+#include "../vowpalwabbit/vw.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+int users = 1000;
+int items = 1000;
+int model_rank = 10;
+int truth_rank = 4;
+int examples = 200000;
+int topk = 10;
+int seed = 1;
+string vwparams;
+
+double now()
+{
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+double uniform()
+{
+        return rand() / (RAND_MAX + 1.0);
+}
+
+typedef pair<float, int> scored_item;
+
+struct compare_scored_items
+{
+    bool operator()(scored_item const& a, scored_item const& b) const
+    {
+        return a.first > b.first;
+    }
+};
+
+int main(int argc, char *argv[])
+{
+        bool new_mf = false;
+        po::variables_map vm;
+        po::options_description desc("Allowed options");
+        desc.add_options()
+                ("help,h", "produce help message")
+                ("users,U", po::value<int>(&users), "number of users")
+                ("items,I", po::value<int>(&items), "number of items")
+                ("rank,r", po::value<int>(&model_rank), "rank of the model")
+                ("truth_rank", po::value<int>(&truth_rank), "rank of the synthetic ratings")
+                ("examples,n", po::value<int>(&examples), "number of training examples")
+                ("topk", po::value<int>(&topk), "number of items to recommend per user")
+                ("seed", po::value<int>(&seed), "seed for the synthetic data")
+                ("new_mf", "benchmark the reduction-based matrix factorization")
+                ("vwparams", po::value<string>(&vwparams), "further vw parameters")
+                ;
+
+        try {
+                po::store(po::parse_command_line(argc, argv, desc), vm);
+                po::notify(vm);
+        }
+        catch(exception & e)
+        {
+                cout << endl << argv[0] << ": " << e.what() << endl << endl << desc << endl;
+                exit(2);
+        }
+
+        if (vm.count("help")) {
+                cout << desc << "\n";
+                return 1;
+        }
+        new_mf = vm.count("new_mf") > 0;
+
+        // ratings are the inner product of hidden user and item vectors
+        srand(seed);
+        vector<float> u(users * truth_rank), v(items * truth_rank);
+        for (size_t j = 0; j < u.size(); j++) u[j] = (float)(2 * uniform() - 1);
+        for (size_t j = 0; j < v.size(); j++) v[j] = (float)(2 * uniform() - 1);
+
+        char params[256];
+        sprintf(params, "--quiet -q ui --rank %d -b 18 %s", model_rank, new_mf ? "--new_mf" : "--power_t 0 -l 0.05");
+        vw* model = VW::initialize(string(params) + " " + vwparams);
+
+        char estr[128];
+        double loss = 0.;
+        double start = now();
+        for (int n = 0; n < examples; n++)
+        {
+                int user = rand() % users, item = rand() % items;
+                float rating = 0.;
+                for (int k = 0; k < truth_rank; k++)
+                        rating += u[user * truth_rank + k] * v[item * truth_rank + k];
+                sprintf(estr, "%f |u %d |i %d", rating, user, item);
+
+                example *ex = VW::read_example(*model, estr);
+                model->learn(ex);
+                loss += ex->loss;
+                VW::finish_example(*model, ex);
+        }
+        double train_time = now() - start;
+
+        // scoring: unlabeled examples are predicted without an update
+        priority_queue<scored_item, vector<scored_item>, compare_scored_items > pr_queue;
+        double checksum = 0.;
+        start = now();
+        for (int user = 0; user < users; user++)
+        {
+                for (int item = 0; item < items; item++)
+                {
+                        sprintf(estr, "|u %d |i %d", user, item);
+                        example *ex = VW::read_example(*model, estr);
+                        model->learn(ex);
+
+                        if ((int)pr_queue.size() < topk)
+                                pr_queue.push(make_pair(ex->final_prediction, item));
+                        else if (pr_queue.top().first < ex->final_prediction)
+                        {
+                                pr_queue.pop();
+                                pr_queue.push(make_pair(ex->final_prediction, item));
+                        }
+
+                        VW::finish_example(*model, ex);
+                }
+                while (!pr_queue.empty())
+                {
+                        checksum += pr_queue.top().first;
+                        pr_queue.pop();
+                }
+        }
+        double score_time = now() - start;
+        long pairs = (long)users * items;
+
+        fprintf(stderr, "%s rank %d\n", new_mf ? "new_mf" : "gd_mf", model_rank);
+        fprintf(stderr, "train: %d examples in %.3f s, %.0f examples/s, average loss %f\n",
+                examples, train_time, examples / train_time, loss / examples);
+        fprintf(stderr, "score: %ld pairs in %.3f s, %.0f pairs/s, top %d checksum %f\n",
+                pairs, score_time, pairs / score_time, topk, checksum);
+
+        VW::finish(*model);
+        exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,349 @@
+// top k recommendations from a matrix factorization (gd_mf, --rank) model
+// without going through the learner for every user x item pair.
+//
+// The user and item lines are read once and reduced to a bias (their
+// linear weights) and a factor vector (x . l^k for the left namespace of
+// the model's pair, x . r^k for the right one), the layout gd_mf_weights
+// reads.  The score of a pair is then
+//   constant + user bias + item bias + user factors . item factors,
+// which is what the model predicts for the concatenated example.  Scores
+// are computed a block of users against a block of items at a time, so
+// the item block stays in cache, and users are split across threads.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <iostream>
+#include <boost/program_options.hpp>
+
+#include "../vowpalwabbit/parser.h"
+#include "../vowpalwabbit/gd.h"
+#include "../vowpalwabbit/vw.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+int topk = 10;
+int threads = 1;
+int verbose = 0;
+size_t chunk = 4096;         // users scored between two writes of the output
+const size_t user_block = 16;
+const size_t item_block = 256;
+
+string blacklistfilename;
+string itemfilename;
+string userfilename;
+string vwparams;
+
+// rows of bias and factors, the factors padded to a multiple of 4 floats
+struct factor_matrix {
+        size_t rows;
+        size_t width;
+        vector<float> bias;
+        vector<float> factors;
+        vector<string> lines;
+};
+
+struct scored_item {
+        float score;
+        uint32_t item;
+};
+
+bool better(const scored_item& a, const scored_item& b) { return a.score > b.score; }
+
+struct worker {
+        pthread_t thread;
+        const factor_matrix* users;
+        const factor_matrix* items;
+        const vector<vector<uint32_t> >* banned;
+        size_t begin, end;            // users of this worker in the current chunk
+        vector<scored_item> results;  // topk per user, best first
+        vector<float> scores;
+};
+
+void chop(char* line)
+{
+        size_t len = strlen(line);
+        if (len > 0 && line[len-1] == '\n')
+                line[len-1] = 0;
+}
+
+// bias and factors of every line of file; ns is the namespace whose
+// features carry the factors at offset+1 .. offset+rank
+void read_factors(vw& model, const string& filename, unsigned char ns, size_t offset, factor_matrix& m, float& constant)
+{
+        FILE* file = fopen(filename.c_str(), "r");
+        if (file == NULL)
+        {
+                fprintf(stderr, "can't open %s: %s\n", filename.c_str(), strerror(errno));
+                exit(2);
+        }
+
+        size_t rank = model.rank;
+        weight* weights = model.reg.weight_vector;
+        size_t mask = model.reg.weight_mask;
+        m.width = (rank + 3) & ~(size_t)3;
+        m.rows = 0;
+
+        char* line = NULL;
+        size_t len = 0;
+        while (getline(&line, &len, file) != -1)
+        {
+                chop(line);
+                m.lines.push_back(line);
+                example* ec = VW::read_example(model, line);
+
+                float bias = 0.;
+                for (unsigned char* i = ec->indices.begin; i != ec->indices.end; i++)
+                {
+                        if (*i == constant_namespace)
+                        {
+                                feature* f = ec->atomics[constant_namespace].begin;
+                                constant = weights[f->weight_index & mask];
+                                continue;
+                        }
+                        for (feature* f = ec->atomics[*i].begin; f != ec->atomics[*i].end; f++)
+                                bias += f->x * weights[f->weight_index & mask];
+                }
+                m.bias.push_back(bias);
+
+                size_t row = m.factors.size();
+                m.factors.resize(row + m.width, 0.f);
+                for (feature* f = ec->atomics[ns].begin; f != ec->atomics[ns].end; f++)
+                        for (size_t k = 0; k < rank; k++)
+                                m.factors[row + k] += f->x * weights[(f->weight_index + offset + k + 1) & mask];
+
+                VW::finish_example(model, ec);
+                m.rows++;
+        }
+        free(line);
+        fclose(file);
+}
+
+// banned[user] holds the sorted item indices that user must not get.  a
+// blacklist line is a user line followed by an item line, as for recommend
+void read_blacklist(const string& filename, const factor_matrix& users, const factor_matrix& items, vector<vector<uint32_t> >& banned)
+{
+        map<string, uint32_t> user_index, item_index;
+        for (size_t u = 0; u < users.rows; u++) user_index[users.lines[u]] = (uint32_t)u;
+        for (size_t i = 0; i < items.rows; i++) item_index[items.lines[i]] = (uint32_t)i;
+        banned.resize(users.rows);
+
+        FILE* file = fopen(filename.c_str(), "r");
+        if (file == NULL)
+        {
+                fprintf(stderr, "can't open %s: %s\n", filename.c_str(), strerror(errno));
+                exit(2);
+        }
+        char* line = NULL;
+        size_t len = 0;
+        size_t unknown = 0;
+        while (getline(&line, &len, file) != -1)
+        {
+                chop(line);
+                string pair(line);
+                // try every split between a user line and an item line
+                bool found = false;
+                for (size_t cut = pair.find('|', 1); cut != string::npos && !found; cut = pair.find('|', cut + 1))
+                {
+                        map<string, uint32_t>::iterator u = user_index.find(pair.substr(0, cut));
+                        map<string, uint32_t>::iterator i = item_index.find(pair.substr(cut));
+                        if (u != user_index.end() && i != item_index.end())
+                        {
+                                banned[u->second].push_back(i->second);
+                                found = true;
+                        }
+                }
+                if (!found) unknown++;
+        }
+        for (size_t u = 0; u < banned.size(); u++)
+                sort(banned[u].begin(), banned[u].end());
+        if (verbose > 0 && unknown > 0)
+                fprintf(stderr, "%lu blacklist lines match no user and item\n", (unsigned long)unknown);
+        free(line);
+        fclose(file);
+}
+
+// keeps the topk best of heap[0..n) as a min-heap on score
+inline void offer(scored_item* heap, size_t& n, scored_item s)
+{
+        if (n < (size_t)topk)
+        {
+                heap[n++] = s;
+                push_heap(heap, heap + n, better);
+        }
+        else if (s.score > heap[0].score)
+        {
+                pop_heap(heap, heap + n, better);
+                heap[n-1] = s;
+                push_heap(heap, heap + n, better);
+        }
+}
+
+void* score_users(void* arg)
+{
+        worker& w = *(worker*)arg;
+        const factor_matrix& users = *w.users;
+        const factor_matrix& items = *w.items;
+        size_t width = users.width;
+
+        size_t count = w.end - w.begin;
+        w.results.resize(count * topk);
+        vector<size_t> filled(count, 0);
+        w.scores.resize(user_block * item_block);
+
+        for (size_t u0 = w.begin; u0 < w.end; u0 += user_block)
+        {
+                size_t u1 = min(u0 + user_block, w.end);
+                for (size_t i0 = 0; i0 < items.rows; i0 += item_block)
+                {
+                        size_t i1 = min(i0 + item_block, items.rows);
+
+                        // the dot products of the block, rank contiguous in both rows
+                        for (size_t u = u0; u < u1; u++)
+                        {
+                                const float* uf = &users.factors[u * width];
+                                float* s = &w.scores[(u - u0) * item_block];
+                                for (size_t i = i0; i < i1; i++)
+                                {
+                                        const float* vf = &items.factors[i * width];
+                                        float dot = 0.;
+                                        for (size_t k = 0; k < width; k++)
+                                                dot += uf[k] * vf[k];
+                                        s[i - i0] = dot + items.bias[i];
+                                }
+                        }
+
+                        for (size_t u = u0; u < u1; u++)
+                        {
+                                const float* s = &w.scores[(u - u0) * item_block];
+                                scored_item* heap = &w.results[(u - w.begin) * topk];
+                                size_t& n = filled[u - w.begin];
+                                const vector<uint32_t>* banned = w.banned->size() > 0 ? &(*w.banned)[u] : NULL;
+                                for (size_t i = i0; i < i1; i++)
+                                {
+                                        if (n == (size_t)topk && s[i - i0] <= heap[0].score)
+                                                continue;
+                                        if (banned != NULL && binary_search(banned->begin(), banned->end(), (uint32_t)i))
+                                                continue;
+                                        scored_item si = { s[i - i0], (uint32_t)i };
+                                        offer(heap, n, si);
+                                }
+                        }
+                }
+        }
+
+        // best first; users with fewer than topk allowed items end with item -1
+        for (size_t u = 0; u < count; u++)
+        {
+                scored_item* heap = &w.results[u * topk];
+                sort_heap(heap, heap + filled[u], better);
+                for (size_t j = filled[u]; j < (size_t)topk; j++)
+                        heap[j].item = (uint32_t)-1;
+        }
+        return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+        po::variables_map vm;
+        po::options_description desc("Allowed options");
+        desc.add_options()
+                ("help,h", "produce help message")
+                ("topk", po::value<int>(&topk), "number of items to recommend per user")
+                ("threads,t", po::value<int>(&threads), "number of threads scoring users")
+                ("verbose,v", po::value<int>(&verbose), "increase verbosity")
+                ("blacklist,B", po::value<string>(&blacklistfilename), "user item pairs (in vw format) that we should not recommend (have been seen before)")
+                ("users,U", po::value<string>(&userfilename), "users portion in vw format to make recs for")
+                ("items,I", po::value<string>(&itemfilename), "items (in vw format) to recommend from")
+                ("vwparams", po::value<string>(&vwparams), "vw parameters for model instantiation (-i model ...)")
+                ;
+
+        try {
+                po::store(po::parse_command_line(argc, argv, desc), vm);
+                po::notify(vm);
+        }
+        catch(exception & e)
+        {
+                cout << endl << argv[0] << ": " << e.what() << endl << endl << desc << endl;
+                exit(2);
+        }
+
+        if (vm.count("help") || userfilename.empty() || itemfilename.empty() || vwparams.empty() || topk <= 0 || threads <= 0)
+        {
+                cout << "Top k recommendations for every user from a gd_mf (--rank) model." << endl;
+                cout << "Prints score, user line and item line for each recommendation, best first." << endl;
+                cout << endl;
+                cout << desc << "\n";
+                cout << "Example usage:" << endl;
+                cout << "    ./mf_topk -U users -I items --topk 20 -t 8 --vwparams '-i movielens.reg -t'" << endl;
+                exit(2);
+        }
+
+        vw* model = VW::initialize(vwparams);
+        if (model->rank == 0 || model->pairs.size() == 0)
+        {
+                cerr << "the model is not a matrix factorization (--rank) model" << endl;
+                exit(2);
+        }
+        unsigned char left_ns = model->pairs[0][0];
+        unsigned char right_ns = model->pairs[0][1];
+
+        float constant = 0.;
+        factor_matrix users, items;
+        if (verbose > 0) fprintf(stderr, "reading users and items...\n");
+        read_factors(*model, userfilename, left_ns, 0, users, constant);
+        read_factors(*model, itemfilename, right_ns, model->rank, items, constant);
+        for (size_t u = 0; u < users.rows; u++)
+                users.bias[u] += constant;
+
+        vector<vector<uint32_t> > banned;
+        if (!blacklistfilename.empty())
+                read_blacklist(blacklistfilename, users, items, banned);
+
+        if (verbose > 0)
+                fprintf(stderr, "%lu users, %lu items, rank %lu, %d threads\n",
+                        (unsigned long)users.rows, (unsigned long)items.rows, (unsigned long)model->rank, threads);
+
+        vector<worker> workers(threads);
+        for (size_t c0 = 0; c0 < users.rows; c0 += chunk)
+        {
+                size_t c1 = min(c0 + chunk, users.rows);
+                size_t per = (c1 - c0 + threads - 1) / threads;
+                for (int t = 0; t < threads; t++)
+                {
+                        worker& w = workers[t];
+                        w.users = &users;
+                        w.items = &items;
+                        w.banned = &banned;
+                        w.begin = min(c0 + t * per, c1);
+                        w.end = min(w.begin + per, c1);
+                        pthread_create(&w.thread, NULL, score_users, &w);
+                }
+                for (int t = 0; t < threads; t++)
+                        pthread_join(workers[t].thread, NULL);
+
+                for (int t = 0; t < threads; t++)
+                {
+                        worker& w = workers[t];
+                        for (size_t u = w.begin; u < w.end; u++)
+                        {
+                                // the bias of the user does not change the ranking, only the score
+                                float user_bias = users.bias[u];
+                                const scored_item* r = &w.results[(u - w.begin) * topk];
+                                for (int j = 0; j < topk && r[j].item != (uint32_t)-1; j++)
+                                        cout << GD::finalize_prediction(*model, r[j].score + user_bias) << "\t"
+                                             << users.lines[u] << items.lines[r[j].item] << "\n";
+                        }
+                }
+        }
+        cout.flush();
+
+        VW::finish(*model);
+        exit(EXIT_SUCCESS);
+}
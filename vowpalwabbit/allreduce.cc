@@ -21,6 +21,7 @@ Alekh Agarwal and John Langford, with help Olivier Chapelle.
 #endif
 #include <sys/timeb.h>
 #include "allreduce.h"
+#include "profile.h"
 
 using namespace std;
 
@@ -391,7 +392,11 @@ void all_reduce(float* buffer, const int n, const string master_location, const
 {
   if(master_location != socks.current_master) 
     all_reduce_init(master_location, unique_id, total, node, socks);
+  uint64_t start = PROFILE::ticks();
   reduce((char*)buffer, n*sizeof(float), socks.parent, socks.children);
   broadcast((char*)buffer, n*sizeof(float), socks.parent, socks.children);
+  socks.ticks += PROFILE::ticks() - start;
+  socks.reduces++;
+  socks.bytes += n*sizeof(float);
 }
 
@@ -8,6 +8,7 @@ license as described in the file LICENSE.
 #ifndef ALLREDUCE_H
 #define ALLREDUCE_H
 #include <string>
+#include <stdint.h>
 #ifdef _WIN32
 #include <WinSock2.h>
 #include <WS2tcpip.h>
@@ -29,6 +30,9 @@ struct node_socks {
   std::string current_master;
   socket_t parent;
   socket_t children[2];
+  size_t reduces; //all_reduce calls, the bytes reduced and the time
+  size_t bytes;    //they took, for --profile
+  uint64_t ticks;
   ~node_socks()
   {
     if(current_master != "") {
@@ -43,6 +47,9 @@ struct node_socks {
   node_socks ()
   {
     current_master = "";
+    reduces = 0;
+    bytes = 0;
+    ticks = 0;
   }
 };
 
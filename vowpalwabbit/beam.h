@@ -9,15 +9,11 @@ license as described in the file LICENSE.
 #include <stdio.h>
 #include <float.h>
 #include <stdlib.h>
+#include <algorithm>
 #include "v_array.h"
 
 using namespace std;
 
-// TODO: special case the version where beam_size == 1
-// TODO: *maybe* special case the version where beam_size <= 10
-
-#define BEAM_CONSTANT_SIZE   0
-
 namespace Beam {
 
 struct beam_element {
@@ -25,6 +21,7 @@ struct beam_element {
   float    cost;   // cost of this element
   void*    data;   // pointer to element data -- rarely accessed!
   bool     active; // is this currently active
+  size_t   order;  // how many elements were inserted before this one; breaks ties
   /* TODO: recombination
   bool     recombined;                 // if we're not the BEST then we've been recombined
   v_array<void*> * recomb_friends;   // if we're the BEST (among ~= elements), then recomb_friends is everything that's equivalent to us but worse... NOT USED if we're not doing k-best predictions
@@ -55,6 +52,71 @@ inline int compare_on_hash_then_cost(const void *void_a, const void *void_b) {
   else return 0;
 }
 
+inline bool before_on_cost(const beam_element& a, const beam_element& b) {
+  int c = compare_on_cost(&a, &b);
+  return (c < 0) || ((c == 0) && (a.order < b.order));  // among equals, the first inserted wins
+}
+
+// hands out T's (or runs of them) from chunks that are never moved, so
+// pointers stay good until reset(), which makes all the memory available
+// again without freeing it.  reused T's are *not* cleared.
+template<class T> class pool {
+ private:
+  struct chunk {
+    T*     data;
+    size_t size;
+  };
+  v_array<chunk> chunks;
+  size_t cur;         // the chunk we're handing out from
+  size_t used;        // how much of it is handed out
+  size_t chunk_size;
+
+ public:
+  pool(size_t chunk_size=1024) : cur(0), used(0), chunk_size(chunk_size) {}
+
+  T* get(size_t n=1) {
+    while ((cur < chunks.size()) && (used + n > chunks[cur].size)) {
+      cur++;
+      used = 0;
+    }
+    if (cur == chunks.size()) {
+      chunk c;
+      c.size = max(n, chunk_size);
+      c.data = (T*)calloc(c.size, sizeof(T));
+      if (c.data == NULL) {
+        std::cerr << "calloc of " << c.size << " failed in pool::get().  out of memory?" << std::endl;
+        throw std::exception();
+      }
+      chunks.push_back(c);
+    }
+    T* t = chunks[cur].data + used;
+    used += n;
+    return t;
+  }
+
+  void reset() { cur = 0; used = 0; }
+
+  // free_item gets every T that was ever handed out, or that's still zero from calloc
+  void delete_pool(void (*free_item)(T&)=NULL) {
+    for (chunk* c = chunks.begin; c != chunks.end; ++c) {
+      if (free_item)
+        for (size_t i=0; i<c->size; i++)
+          free_item(c->data[i]);
+      free(c->data);
+    }
+    chunks.delete_v();
+    reset();
+  }
+
+  ~pool() { assert(chunks.size() == 0); }
+};
+
+// without recombination, A is a min-max heap of the beam_size best
+// elements: even levels are no more costly than everything below them, odd
+// levels no less, so both the best and the worst are at the top and an
+// insert into a full beam is O(log beam_size).  with recombination,
+// everything that might survive is kept until compaction, which needs all
+// of the equivalent elements at once.
 class beam {
  private:
   size_t beam_size;   // the beam size -- how many active elements can we have
@@ -64,10 +126,80 @@ class beam {
   float  best_cost;   // what is the cost of the best (lowest cost) item in the beam
   float  prune_if_gt; // prune any element with cost greater than this
   void*  best_cost_data;  // easy access to best-cost item
+  bool   is_heap;     // false once compact() has sorted A
+  size_t inserted;    // elements inserted since the last erase()
   v_array<beam_element> A; // the actual data
   
   bool (*is_equivalent)(void*,void*);  // test if two items are equivalent; NULL means don't do hypothesis recombination
-  
+
+  static bool on_min_level(size_t i) {
+    size_t level = 0;
+    for (i++; i > 1; i >>= 1) level++;
+    return (level % 2) == 0;
+  }
+
+  bool better(size_t i, size_t j, bool min_level) {
+    return min_level ? before_on_cost(A[i], A[j]) : before_on_cost(A[j], A[i]);
+  }
+
+  void bubble_up(size_t i, bool min_level) {
+    while (i > 2) {
+      size_t grandparent = (((i-1)/2)-1)/2;
+      if (!better(i, grandparent, min_level)) break;
+      std::swap(A[i], A[grandparent]);
+      i = grandparent;
+    }
+  }
+
+  void push_up(size_t i) {
+    if (i == 0) return;
+    size_t parent = (i-1)/2;
+    bool min_level = on_min_level(i);
+    if (better(i, parent, !min_level)) {   // belongs on the parent's levels
+      std::swap(A[i], A[parent]);
+      bubble_up(parent, !min_level);
+    } else
+      bubble_up(i, min_level);
+  }
+
+  void trickle_down(size_t i) {
+    bool min_level = on_min_level(i);
+    while (true) {
+      // the best of the children and grandchildren
+      size_t m = 0;
+      for (size_t c=2*i+1; (c <= 2*i+2) && (c < count); c++) {
+        if ((m == 0) || better(c, m, min_level)) m = c;
+        for (size_t g=2*c+1; (g <= 2*c+2) && (g < count); g++)
+          if (better(g, m, min_level)) m = g;
+      }
+      if ((m == 0) || !better(m, i, min_level)) return;
+      std::swap(A[m], A[i]);
+      if (m <= 2*i+2) return;                 // a child, which has nothing below it to fix
+      size_t parent = (m-1)/2;
+      if (better(parent, m, min_level)) std::swap(A[m], A[parent]);
+      i = m;
+    }
+  }
+
+  size_t worst_index() {
+    if (count <= 2) return count - 1;
+    return better(1, 2, false) ? 1 : 2;
+  }
+
+  void make_heap() {
+    for (size_t i=count/2; i-- > 0; )
+      trickle_down(i);
+    is_heap = true;
+  }
+
+  void update_costs() {
+    if (count == 0) return;
+    best_cost = A[0].cost;
+    best_cost_data = A[0].data;
+    worst_cost = A[worst_index()].cost;
+    prune_if_gt = max(1.f, best_cost) * pruning_coefficient;
+  }
+
  public:
   beam(size_t beam_size, float prune_coeff=FLT_MAX, bool (*test_equiv)(void*,void*)=NULL)
       : beam_size(beam_size)
@@ -78,62 +210,74 @@ class beam {
     best_cost   =  FLT_MAX;
     prune_if_gt =  FLT_MAX;
     best_cost_data = NULL;
-    if (beam_size <= BEAM_CONSTANT_SIZE)
-      A.resize(beam_size, true);
-    else
+    is_heap = true;
+    inserted = 0;
+    if (is_equivalent)
       A.resize((beam_size+1) * 4, true);
+    else
+      A.resize(beam_size+1, true);
   }
 
-  bool insert(void*data, float cost, uint32_t hash) { // returns TRUE iff element was actually added
+  // returns TRUE iff element was actually added; free_data gets whatever
+  // it pushes out of a full beam
+  bool insert(void*data, float cost, uint32_t hash, void (*free_data)(void*)=NULL) {
     bool should_add = false;
 
     if (count < beam_size) should_add = true;
     else if (cost < worst_cost) should_add = true;
     if (cost > prune_if_gt) should_add = false;
     
-    //cerr << "insert " << ((size_t)data) << " with cost=" << cost << " wc=" << worst_cost << " count=" << count << " size=" << beam_size << " has should_add=" << should_add << endl;
-    
     if (!should_add) return false;
 
-    if (beam_size < BEAM_CONSTANT_SIZE) {
-      // find the worst item and directly replace it
-      size_t worst_idx = 0;
-      float  worst_idx_cost = A[0].cost;
-      for (size_t i=1; i<beam_size; i++)
-        if (A[i].cost > worst_idx_cost) {
-          worst_idx = i;
-          worst_idx_cost = A[i].cost;
-          if (worst_idx_cost <= worst_cost)
-            break;
-        }
-      if (cost >= worst_idx_cost)
-        return false;
-      
-      A[worst_idx].hash = hash;
-      A[worst_idx].cost = cost;
-      A[worst_idx].data = data;
-      A[worst_idx].active = true;
-      worst_cost = cost;
-    } else {
-      beam_element be;
-      be.hash = hash;
-      be.cost = cost;
-      be.data = data;
-      be.active = true;
+    beam_element be;
+    be.hash = hash;
+    be.cost = cost;
+    be.data = data;
+    be.active = true;
+    be.order = inserted++;
 
+    if (is_equivalent) {
       A.push_back(be);
       count++;
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_cost_data = data;
+      }
+      if (cost > worst_cost) {
+        worst_cost  = cost;
+        prune_if_gt = max(1.f, best_cost) * pruning_coefficient;
+      }
+      return true;
     }
-    
-    if (cost < best_cost) {
-      best_cost = cost;
-      best_cost_data = data;
+
+    if (beam_size == 1) {  // the best and the worst are the same one
+      if (count == 0) {
+        A.push_back(be);
+        count++;
+      } else {
+        if (free_data) free_data(A[0].data);
+        A[0] = be;
+      }
+      update_costs();
+      return true;
     }
-    if (cost > worst_cost) {
-      worst_cost  = cost;
-      prune_if_gt = max(1.f, best_cost) * pruning_coefficient;
+
+    if (!is_heap) make_heap();
+    if (count == beam_size) {  // drop the worst to make room
+      size_t w = worst_index();
+      if (free_data) free_data(A[w].data);
+      A[w] = A[count-1];
+      A.pop();
+      count--;
+      if (w < count) {
+        trickle_down(w);
+        push_up(w);
+      }
     }
-    
+    A.push_back(be);
+    count++;
+    push_up(count-1);
+    update_costs();
     return true;
   }
 
@@ -164,21 +308,26 @@ class beam {
     }
   }
   
+  // leaves the (at most beam_size) survivors in A, sorted by cost
   void compact(void (*free_data)(void*)=NULL) {
+    if (count == 0) return;
     if (is_equivalent) do_recombination();
-    qsort(A.begin, A.size(), sizeof(beam_element), compare_on_cost); // TODO: quick select
 
-    if (count <= beam_size) return;
+    if (count > beam_size) {  // only with recombination: select the best, then drop the rest
+      std::nth_element(A.begin, A.begin + beam_size, A.end, before_on_cost);
+      if (free_data)
+        for (beam_element * be = A.begin+beam_size; be != A.end; ++be)
+          free_data(be->data);
+      A.end = A.begin + beam_size;
+      count = beam_size;
+    }
+    std::sort(A.begin, A.end, before_on_cost);
+    is_heap = false;
 
-    count = beam_size;
-    if (is_equivalent) // we might be able to get rid of even more
+    if (is_equivalent) { // we might be able to get rid of even more
       while ((count > 1) && !A[count-1].active) count--;
-    
-    if (free_data)
-      for (beam_element * be = A.begin+count; be != A.end; ++be)
-        free_data(be->data);
-
-    A.end = A.begin + count;
+      A.end = A.begin + count;
+    }
 
     best_cost = A[0].cost;
     worst_cost = A[count-1].cost;
@@ -187,7 +336,7 @@ class beam {
   }
 
   void maybe_compact(void (*free_data)(void*)=NULL) {
-    if (count >= beam_size * 10)
+    if (is_equivalent && (count >= beam_size * 10))
       compact(free_data);
   }
 
@@ -201,6 +350,8 @@ class beam {
     best_cost   =  FLT_MAX;
     prune_if_gt =  FLT_MAX;
     best_cost_data = NULL;
+    is_heap = true;
+    inserted = 0;
   }
 
   ~beam() {
@@ -214,8 +365,6 @@ class beam {
   bool           empty() { return A.empty(); }
 };
 
-
-
 }
 
 
@@ -88,9 +88,16 @@ namespace BFGS
     // set by initializer
     int mem_stride;
     bool output_regularizer;
-    float* mem;
+    void* mem;           // history rows of mem_stride floats or bf16s
     double* rho;
     double* alpha;
+
+    // history storage layout
+    bool mem_bf16;       // store history entries as bfloat16
+    bool mem_sparse;     // one history row per weight touched in the first pass
+    size_t mem_rows;     // number of history rows
+    uint32_t* mem_index; // mem_sparse: weight index of each history row
+    uint32_t* touched;   // mem_sparse: bitmap of weights seen during the first pass
     
     weight* regularizers;
     // the below needs to be included when resetting, in addition to preconditioner and derivative
@@ -111,11 +118,120 @@ const char* curv_message = "Zero or negative curvature detected.\n"
       "It is also possible that you have reached numerical accuracy\n"
       "and further decrease in the objective cannot be reliably detected.\n";
 
+/********************************************************************/
+/* history storage **************************************************/
+/********************************************************************/
+// History rows are either floats or bfloat16s (the upper half of an IEEE
+// float, rounded to nearest even), and either one row per weight or, with
+// --mem_sparse, one row per weight touched during the first pass.  Weights
+// never touched have zero gradient, direction and history forever, so
+// skipping them leaves the iterates unchanged.
+
+struct bf16 { uint16_t bits; };
+
+inline float load(const float& m) { return m; }
+inline void store(float& m, float v) { m = v; }
+
+inline float load(const bf16& m)
+{
+  uint32_t u = (uint32_t)m.bits << 16;
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+inline void store(bf16& m, float v)
+{
+  uint32_t u;
+  memcpy(&u, &v, sizeof(u));
+  u += 0x7fff + ((u >> 16) & 1);
+  m.bits = (uint16_t)(u >> 16);
+}
+
+template<bool sparse>
+inline weight* row_weights(bfgs& b, weight* w, size_t stride, size_t k)
+{ return w + (sparse ? b.mem_index[k] : k) * stride; }
+
+inline void mark_row(bfgs& b, float, float& fw)
+{
+  size_t i = (&fw - b.all->reg.weight_vector) / b.all->reg.stride;
+  b.touched[i >> 5] |= 1u << (i & 31);
+}
+
+// interaction hashes mix in ft_offset, so each of the four slots of a
+// feature can land in a different row; mark the rows of all of them
+void mark_touched(vw& all, bfgs& b, example& ec)
+{
+  for (uint32_t slot = W_XT; slot <= W_COND; slot++)
+    {
+      ec.ft_offset += slot;
+      GD::foreach_feature<bfgs,mark_row>(all, ec, b);
+      ec.ft_offset -= slot;
+    }
+}
+
+size_t history_bytes(bfgs& b, size_t rows)
+{ return rows * b.mem_stride * (b.mem_bf16 ? sizeof(bf16) : sizeof(float)); }
+
+void allocate_history(vw& all, bfgs& b, size_t rows)
+{
+  b.mem_rows = rows;
+  b.mem = calloc(rows * b.mem_stride, b.mem_bf16 ? sizeof(bf16) : sizeof(float));
+  if (b.mem == NULL && rows > 0)
+    {
+      cerr << all.program_name << ": Failed to allocate bfgs history: try decreasing --mem or -b <bits>" << endl;
+      throw exception();
+    }
+}
+
+// after the first pass: keep a history row for every weight that was seen
+// in an example or that has nonzero weight or gradient (priors, -i models)
+void allocate_sparse_history(vw& all, bfgs& b)
+{
+  uint32_t length = 1 << all.num_bits;
+  size_t stride = all.reg.stride;
+  weight* w = all.reg.weight_vector;
+
+  size_t rows = 0;
+  for(uint32_t i = 0; i < length; i++)
+    if ((b.touched[i >> 5] >> (i & 31)) & 1 || w[stride*i+W_XT] != 0. || w[stride*i+W_GT] != 0.)
+      b.touched[i >> 5] |= 1u << (i & 31), rows++;
+
+  b.mem_index = (uint32_t*)malloc(sizeof(uint32_t) * max(rows, (size_t)1));
+  size_t k = 0;
+  for(uint32_t i = 0; i < length; i++)
+    if ((b.touched[i >> 5] >> (i & 31)) & 1)
+      b.mem_index[k++] = i;
+  free(b.touched);
+  b.touched = NULL;
+
+  allocate_history(all, b, rows);
+  if (!all.quiet)
+    fprintf(stderr, "history: %luM for %lu of %lu weights (sparse, %s)\n",
+	    (long unsigned int)(history_bytes(b, rows) + sizeof(uint32_t)*rows) >> 20,
+	    (long unsigned int)rows, (long unsigned int)length, b.mem_bf16 ? "bf16" : "float");
+}
+
+/********************************************************************/
+/* dense passes *****************************************************/
+/********************************************************************/
+// The loops below run over all 2^b weights.  They compute the history
+// ring offsets once, outside the loop, and carry omp pragmas so that a
+// build with openmp (configure --enable-parallelization, or make
+// OPENMP=1) splits them across cores.  The pragmas are only compiled in
+// when _OPENMP is defined; without it the passes run serially as before.
+// The gradient itself is still summed one example at a time on the
+// learner thread, as the driver hands examples over one by one and there
+// is no batch to split into per-thread buffers.
+
 void zero_derivative(vw& all)
 {//set derivative to 0.
   uint32_t length = 1 << all.num_bits;
   size_t stride = all.reg.stride;
   weight* weights = all.reg.weight_vector;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
   for(uint32_t i = 0; i < length; i++)
     weights[stride*i+W_GT] = 0;
 }
@@ -125,6 +241,9 @@ void zero_preconditioner(vw& all)
   uint32_t length = 1 << all.num_bits;
   size_t stride = all.reg.stride;
   weight* weights = all.reg.weight_vector;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
   for(uint32_t i = 0; i < length; i++)
     weights[stride*i+W_COND] = 0;
 }
@@ -218,11 +337,22 @@ double regularizer_direction_magnitude(vw& all, bfgs& b, float regularizer)
   size_t stride = all.reg.stride;
   weight* weights = all.reg.weight_vector;
   if (b.regularizers == NULL)
-    for(uint32_t i = 0; i < length; i++)
-      ret += regularizer*weights[stride*i+W_DIR]*weights[stride*i+W_DIR];
+    {
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:ret)
+#endif
+      for(uint32_t i = 0; i < length; i++)
+	ret += regularizer*weights[stride*i+W_DIR]*weights[stride*i+W_DIR];
+    }
   else
-    for(uint32_t i = 0; i < length; i++) 
-      ret += b.regularizers[2*i]*weights[stride*i+W_DIR]*weights[stride*i+W_DIR];
+    {
+      weight* regularizers = b.regularizers;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:ret)
+#endif
+      for(uint32_t i = 0; i < length; i++) 
+	ret += regularizers[2*i]*weights[stride*i+W_DIR]*weights[stride*i+W_DIR];
+    }
 
   return ret;
 }
@@ -233,15 +363,19 @@ float direction_magnitude(vw& all)
   uint32_t length = 1 << all.num_bits;
   size_t stride = all.reg.stride;
   weight* weights = all.reg.weight_vector;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:ret)
+#endif
   for(uint32_t i = 0; i < length; i++)
     ret += weights[stride*i+W_DIR]*weights[stride*i+W_DIR];
   
   return (float)ret;
 }
 
-void bfgs_iter_start(vw& all, bfgs& b, float* mem, int& lastj, double importance_weight_sum, int&origin)
+template<class T, bool sparse>
+void bfgs_iter_start(vw& all, bfgs& b, T* mem, int& lastj, double importance_weight_sum, int&origin)
 {
-  uint32_t length = 1 << all.num_bits;
+  size_t rows = b.mem_rows;
   size_t stride = all.reg.stride;
   weight* w = all.reg.weight_vector;
 
@@ -249,14 +383,23 @@ void bfgs_iter_start(vw& all, bfgs& b, float* mem, int& lastj, double importance
   double g1_g1 = 0.;
   
   origin = 0;
-  for(uint32_t i = 0; i < length; i++, mem+=b.mem_stride, w+=stride) {
-    if (all.m>0)
-      mem[(MEM_XT+origin)%b.mem_stride] = w[W_XT]; 
-    mem[(MEM_GT+origin)%b.mem_stride] = w[W_GT];
-    g1_Hg1 += w[W_GT] * w[W_GT] * w[W_COND];
-    g1_g1 += w[W_GT] * w[W_GT];
-    w[W_DIR] = -w[W_COND]*w[W_GT];
-    w[W_GT] = 0;
+  size_t mem_stride = b.mem_stride;
+  int gt = (MEM_GT+origin)%b.mem_stride;
+  int xt = (MEM_XT+origin)%b.mem_stride;
+  bool store_xt = all.m>0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:g1_Hg1,g1_g1)
+#endif
+  for(size_t k = 0; k < rows; k++) {
+    T* m = mem + k*mem_stride;
+    weight* wi = row_weights<sparse>(b, w, stride, k);
+    if (store_xt)
+      store(m[xt], wi[W_XT]); 
+    store(m[gt], wi[W_GT]);
+    g1_Hg1 += wi[W_GT] * wi[W_GT] * wi[W_COND];
+    g1_g1 += wi[W_GT] * wi[W_GT];
+    wi[W_DIR] = -wi[W_COND]*wi[W_GT];
+    wi[W_GT] = 0;
   }
   lastj = 0;
   if (!all.quiet)
@@ -265,25 +408,29 @@ void bfgs_iter_start(vw& all, bfgs& b, float* mem, int& lastj, double importance
 	    g1_Hg1/importance_weight_sum, "", "", "");
 }
 
-void bfgs_iter_middle(vw& all, bfgs& b, float* mem, double* rho, double* alpha, int& lastj, int &origin) 
+template<class T, bool sparse>
+void bfgs_iter_middle(vw& all, bfgs& b, T* mem, double* rho, double* alpha, int& lastj, int &origin) 
 {  
-  uint32_t length = 1 << all.num_bits;
+  size_t rows = b.mem_rows;
   size_t stride = all.reg.stride;
   weight* w = all.reg.weight_vector;
-  
-  float* mem0 = mem;
-  float* w0 = w;
+  size_t mem_stride = b.mem_stride;
+  int gt = (MEM_GT+origin)%b.mem_stride;
 
   // implement conjugate gradient
   if (all.m==0) {
     double g_Hy = 0.;
     double g_Hg = 0.;
-    double y = 0.;
   
-    for(uint32_t i = 0; i < length; i++, mem+=b.mem_stride, w+=stride) {
-      y = w[W_GT]-mem[(MEM_GT+origin)%b.mem_stride];
-      g_Hy += w[W_GT] * w[W_COND] * y;
-      g_Hg += mem[(MEM_GT+origin)%b.mem_stride] * w[W_COND] * mem[(MEM_GT+origin)%b.mem_stride];
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:g_Hy,g_Hg)
+#endif
+    for(size_t k = 0; k < rows; k++) {
+      T* m = mem + k*mem_stride;
+      weight* wi = row_weights<sparse>(b, w, stride, k);
+      double y = wi[W_GT]-load(m[gt]);
+      g_Hy += wi[W_GT] * wi[W_COND] * y;
+      g_Hg += load(m[gt]) * wi[W_COND] * load(m[gt]);
     }
 
     float beta = (float) (g_Hy/g_Hg);
@@ -291,14 +438,17 @@ void bfgs_iter_middle(vw& all, bfgs& b, float* mem, double* rho, double* alpha,
     if (beta<0.f || nanpattern(beta))
       beta = 0.f;
       
-    mem = mem0;
-    w = w0;
-    for(uint32_t i = 0; i < length; i++, mem+=b.mem_stride, w+=stride) {
-      mem[(MEM_GT+origin)%b.mem_stride] = w[W_GT];
-
-      w[W_DIR] *= beta;
-      w[W_DIR] -= w[W_COND]*w[W_GT];
-      w[W_GT] = 0;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for(size_t k = 0; k < rows; k++) {
+      T* m = mem + k*mem_stride;
+      weight* wi = row_weights<sparse>(b, w, stride, k);
+      store(m[gt], wi[W_GT]);
+
+      wi[W_DIR] *= beta;
+      wi[W_DIR] -= wi[W_COND]*wi[W_GT];
+      wi[W_GT] = 0;
     }
     if (!all.quiet)
       fprintf(stderr, "%f\t", beta);
@@ -313,14 +463,22 @@ void bfgs_iter_middle(vw& all, bfgs& b, float* mem, double* rho, double* alpha,
   double y_s = 0.;
   double y_Hy = 0.;
   double s_q = 0.;
+  int xt = (MEM_XT+origin)%b.mem_stride;
+  int yt = (MEM_YT+origin)%b.mem_stride;
+  int st = (MEM_ST+origin)%b.mem_stride;
   
-  for(uint32_t i = 0; i < length; i++, mem+=b.mem_stride, w+=stride) {
-    mem[(MEM_YT+origin)%b.mem_stride] = w[W_GT] - mem[(MEM_GT+origin)%b.mem_stride];
-    mem[(MEM_ST+origin)%b.mem_stride] = w[W_XT] - mem[(MEM_XT+origin)%b.mem_stride];
-    w[W_DIR] = w[W_GT];
-    y_s += mem[(MEM_YT+origin)%b.mem_stride]*mem[(MEM_ST+origin)%b.mem_stride];
-    y_Hy += mem[(MEM_YT+origin)%b.mem_stride]*mem[(MEM_YT+origin)%b.mem_stride]*w[W_COND];
-    s_q += mem[(MEM_ST+origin)%b.mem_stride]*w[W_GT];  
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:y_s,y_Hy,s_q)
+#endif
+  for(size_t k = 0; k < rows; k++) {
+    T* m = mem + k*mem_stride;
+    weight* wi = row_weights<sparse>(b, w, stride, k);
+    store(m[yt], wi[W_GT] - load(m[gt]));
+    store(m[st], wi[W_XT] - load(m[xt]));
+    wi[W_DIR] = wi[W_GT];
+    y_s += load(m[yt])*load(m[st]);
+    y_Hy += load(m[yt])*load(m[yt])*wi[W_COND];
+    s_q += load(m[st])*wi[W_GT];  
   }
   
   if (y_s <= 0. || y_Hy <= 0.)
@@ -332,22 +490,35 @@ void bfgs_iter_middle(vw& all, bfgs& b, float* mem, double* rho, double* alpha,
   for (int j=0; j<lastj; j++) {
     alpha[j] = rho[j] * s_q;
     s_q = 0.;
-    mem = mem0;
-    w = w0;
-    for(uint32_t i = 0; i < length; i++, mem+=b.mem_stride, w+=stride) {
-      w[W_DIR] -= (float)alpha[j]*mem[(2*j+MEM_YT+origin)%b.mem_stride];
-      s_q += mem[(2*j+2+MEM_ST+origin)%b.mem_stride]*w[W_DIR];
+    float a = (float)alpha[j];
+    int yj = (2*j+MEM_YT+origin)%b.mem_stride;
+    int sj = (2*j+2+MEM_ST+origin)%b.mem_stride;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:s_q)
+#endif
+    for(size_t k = 0; k < rows; k++) {
+      T* m = mem + k*mem_stride;
+      weight* wi = row_weights<sparse>(b, w, stride, k);
+      wi[W_DIR] -= a*load(m[yj]);
+      s_q += load(m[sj])*wi[W_DIR];
     }
   }
 
   alpha[lastj] = rho[lastj] * s_q;
   double y_r = 0.;  
-  mem = mem0;
-  w = w0;
-  for(uint32_t i = 0; i < length; i++, mem+=b.mem_stride, w+=stride) {
-    w[W_DIR] -= (float)alpha[lastj]*mem[(2*lastj+MEM_YT+origin)%b.mem_stride];
-    w[W_DIR] *= gamma*w[W_COND];
-    y_r += mem[(2*lastj+MEM_YT+origin)%b.mem_stride]*w[W_DIR];
+  {
+    float a = (float)alpha[lastj];
+    int yj = (2*lastj+MEM_YT+origin)%b.mem_stride;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:y_r)
+#endif
+    for(size_t k = 0; k < rows; k++) {
+      T* m = mem + k*mem_stride;
+      weight* wi = row_weights<sparse>(b, w, stride, k);
+      wi[W_DIR] -= a*load(m[yj]);
+      wi[W_DIR] *= gamma*wi[W_COND];
+      y_r += load(m[yj])*wi[W_DIR];
+    }
   }
 
   double coef_j;
@@ -355,41 +526,58 @@ void bfgs_iter_middle(vw& all, bfgs& b, float* mem, double* rho, double* alpha,
   for (int j=lastj; j>0; j--) {
     coef_j = alpha[j] - rho[j] * y_r;
     y_r = 0.;
-    mem = mem0;
-    w = w0;
-    for(uint32_t i = 0; i < length; i++, mem+=b.mem_stride, w+=stride) {
-      w[W_DIR] += (float)coef_j*mem[(2*j+MEM_ST+origin)%b.mem_stride];
-      y_r += mem[(2*j-2+MEM_YT+origin)%b.mem_stride]*w[W_DIR];
+    float c = (float)coef_j;
+    int sj = (2*j+MEM_ST+origin)%b.mem_stride;
+    int yj = (2*j-2+MEM_YT+origin)%b.mem_stride;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:y_r)
+#endif
+    for(size_t k = 0; k < rows; k++) {
+      T* m = mem + k*mem_stride;
+      weight* wi = row_weights<sparse>(b, w, stride, k);
+      wi[W_DIR] += c*load(m[sj]);
+      y_r += load(m[yj])*wi[W_DIR];
     }
   }
 
 
   coef_j = alpha[0] - rho[0] * y_r;
-  mem = mem0;
-  w = w0;
-  for(uint32_t i = 0; i < length; i++, mem+=b.mem_stride, w+=stride) {
-    w[W_DIR] = -w[W_DIR]-(float)coef_j*mem[(MEM_ST+origin)%b.mem_stride];
+  {
+    float c = (float)coef_j;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for(size_t k = 0; k < rows; k++) {
+      weight* wi = row_weights<sparse>(b, w, stride, k);
+      wi[W_DIR] = -wi[W_DIR]-c*load(mem[k*mem_stride+st]);
+    }
   }
   
   /*********************
    ** shift 
    ********************/
 
-  mem = mem0;
-  w = w0;
   lastj = (lastj<all.m-1) ? lastj+1 : all.m-1;
   origin = (origin+b.mem_stride-2)%b.mem_stride;
-  for(uint32_t i = 0; i < length; i++, mem+=b.mem_stride, w+=stride) {
-    mem[(MEM_GT+origin)%b.mem_stride] = w[W_GT];
-    mem[(MEM_XT+origin)%b.mem_stride] = w[W_XT];
-    w[W_GT] = 0;
+  gt = (MEM_GT+origin)%b.mem_stride;
+  xt = (MEM_XT+origin)%b.mem_stride;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for(size_t k = 0; k < rows; k++) {
+    T* m = mem + k*mem_stride;
+    weight* wi = row_weights<sparse>(b, w, stride, k);
+    store(m[gt], wi[W_GT]);
+    store(m[xt], wi[W_XT]);
+    wi[W_GT] = 0;
   }
   for (int j=lastj; j>0; j--)
     rho[j] = rho[j-1];
 }
 
-double wolfe_eval(vw& all, bfgs& b, float* mem, double loss_sum, double previous_loss_sum, double step_size, double importance_weight_sum, int &origin, double& wolfe1) { 
-  uint32_t length = 1 << all.num_bits;
+template<class T, bool sparse>
+double wolfe_eval(vw& all, bfgs& b, T* mem, double loss_sum, double previous_loss_sum, double step_size, double importance_weight_sum, int &origin, double& wolfe1) { 
+  size_t rows = b.mem_rows;
   size_t stride = all.reg.stride;
   weight* w = all.reg.weight_vector;
   
@@ -397,12 +585,18 @@ double wolfe_eval(vw& all, bfgs& b, float* mem, double loss_sum, double previous
   double g1_d = 0.;
   double g1_Hg1 = 0.;
   double g1_g1 = 0.;
+  size_t mem_stride = b.mem_stride;
+  int gt = (MEM_GT+origin)%b.mem_stride;
   
-  for(uint32_t i = 0; i < length; i++, mem+=b.mem_stride, w+=stride) {
-    g0_d += mem[(MEM_GT+origin)%b.mem_stride] * w[W_DIR];
-    g1_d += w[W_GT] * w[W_DIR];
-    g1_Hg1 += w[W_GT] * w[W_GT] * w[W_COND];
-    g1_g1 += w[W_GT] * w[W_GT];
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:g0_d,g1_d,g1_Hg1,g1_g1)
+#endif
+  for(size_t k = 0; k < rows; k++) {
+    weight* wi = row_weights<sparse>(b, w, stride, k);
+    g0_d += load(mem[k*mem_stride+gt]) * wi[W_DIR];
+    g1_d += wi[W_GT] * wi[W_DIR];
+    g1_Hg1 += wi[W_GT] * wi[W_GT] * wi[W_COND];
+    g1_g1 += wi[W_GT] * wi[W_GT];
   }
   
   wolfe1 = (loss_sum-previous_loss_sum)/(step_size*g0_d);
@@ -423,6 +617,9 @@ double add_regularization(vw& all, bfgs& b, float regularization)
   weight* weights = all.reg.weight_vector;
   if (b.regularizers == NULL)
     {
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:ret)
+#endif
       for(uint32_t i = 0; i < length; i++) {
 	weights[stride*i+W_GT] += regularization*weights[stride*i];
 	ret += 0.5*regularization*weights[stride*i]*weights[stride*i];
@@ -430,10 +627,14 @@ double add_regularization(vw& all, bfgs& b, float regularization)
     }
   else
     {
+      weight* regularizers = b.regularizers;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:ret)
+#endif
       for(uint32_t i = 0; i < length; i++) {
-	weight delta_weight = weights[stride*i] - b.regularizers[2*i+1];
-	weights[stride*i+W_GT] += b.regularizers[2*i]*delta_weight;
-	ret += 0.5*b.regularizers[2*i]*delta_weight*delta_weight;
+	weight delta_weight = weights[stride*i] - regularizers[2*i+1];
+	weights[stride*i+W_GT] += regularizers[2*i]*delta_weight;
+	ret += 0.5*regularizers[2*i]*delta_weight*delta_weight;
       }
     }
 
@@ -448,6 +649,9 @@ void finalize_preconditioner(vw& all, bfgs& b, float regularization)
   float max_hessian = 0.f;
 
   if (b.regularizers == NULL)
+#ifdef _OPENMP
+#pragma omp parallel for reduction(max:max_hessian)
+#endif
     for(uint32_t i = 0; i < length; i++) {
       weights[stride*i+W_COND] += regularization;
 	  if (weights[stride*i+W_COND] > max_hessian)
@@ -456,6 +660,9 @@ void finalize_preconditioner(vw& all, bfgs& b, float regularization)
 	weights[stride*i+W_COND] = 1.f / weights[stride*i+W_COND];
     }
   else
+#ifdef _OPENMP
+#pragma omp parallel for reduction(max:max_hessian)
+#endif
     for(uint32_t i = 0; i < length; i++) {
       weights[stride*i+W_COND] += b.regularizers[2*i];
 	  if (weights[stride*i+W_COND] > max_hessian)
@@ -466,6 +673,9 @@ void finalize_preconditioner(vw& all, bfgs& b, float regularization)
 
   float max_precond = (max_hessian==0.f) ? 0.f : max_precond_ratio / max_hessian;
   weights = all.reg.weight_vector;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
   for(uint32_t i = 0; i < length; i++) {
     if (infpattern(weights[stride*i+W_COND]) || weights[stride*i+W_COND]>max_precond)
 			weights[stride*i+W_COND] = max_precond;
@@ -501,6 +711,9 @@ void zero_state(vw& all)
   uint32_t length = 1 << all.num_bits;
   size_t stride = all.reg.stride;
   weight* weights = all.reg.weight_vector;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
   for(uint32_t i = 0; i < length; i++) 
     {
       weights[stride*i+W_GT] = 0;
@@ -509,26 +722,40 @@ void zero_state(vw& all)
     }
 }
 
-double derivative_in_direction(vw& all, bfgs& b, float* mem, int &origin)
+template<class T, bool sparse>
+double derivative_in_direction(vw& all, bfgs& b, T* mem, int &origin)
   {  
   double ret = 0.;
-  uint32_t length = 1 << all.num_bits;
+  size_t rows = b.mem_rows;
   size_t stride = all.reg.stride;
   weight* w = all.reg.weight_vector;
+  size_t mem_stride = b.mem_stride;
+  int gt = (MEM_GT+origin)%b.mem_stride;
   
-  for(uint32_t i = 0; i < length; i++, w+=stride, mem+=b.mem_stride)
-    ret += mem[(MEM_GT+origin)%b.mem_stride]*w[W_DIR];
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:ret)
+#endif
+  for(size_t k = 0; k < rows; k++)
+    ret += load(mem[k*mem_stride+gt])*row_weights<sparse>(b, w, stride, k)[W_DIR];
   return ret;
 }
-  
+
+// call the instantiation of f matching the history layout of b
+#define HISTORY_CALL(f, ...) (b.mem_bf16 ?				\
+  (b.mem_sparse ? f<bf16,true>(all, b, (bf16*)b.mem, __VA_ARGS__) : f<bf16,false>(all, b, (bf16*)b.mem, __VA_ARGS__)) : \
+  (b.mem_sparse ? f<float,true>(all, b, (float*)b.mem, __VA_ARGS__) : f<float,false>(all, b, (float*)b.mem, __VA_ARGS__)))
+
 void update_weight(vw& all, float step_size, size_t current_pass)
   {
     uint32_t length = 1 << all.num_bits;
     size_t stride = all.reg.stride;
     weight* w = all.reg.weight_vector;
     
-    for(uint32_t i = 0; i < length; i++, w+=stride)
-      w[W_XT] += step_size * w[W_DIR];
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for(uint32_t i = 0; i < length; i++)
+      w[i*stride+W_XT] += step_size * w[i*stride+W_DIR];
   }
 
 int process_pass(vw& all, bfgs& b) {
@@ -552,6 +779,8 @@ int process_pass(vw& all, bfgs& b) {
       }
       if (all.l2_lambda > 0.)
 	b.loss_sum += add_regularization(all, b, all.l2_lambda);
+      if (b.mem_sparse)
+	allocate_sparse_history(all, b);
       if (!all.quiet)
 	fprintf(stderr, "%2lu %-10.5f\t", (long unsigned int)b.current_pass+1, b.loss_sum / b.importance_weight_sum);
       
@@ -559,7 +788,7 @@ int process_pass(vw& all, bfgs& b) {
       b.loss_sum = 0.;
       b.example_number = 0;
       b.curvature = 0;
-      bfgs_iter_start(all, b, b.mem, b.lastj, b.importance_weight_sum, b.origin);
+      HISTORY_CALL(bfgs_iter_start, b.lastj, b.importance_weight_sum, b.origin);
       if (b.first_hessian_on) {
 	b.gradient_pass = false;//now start computing curvature
       }
@@ -599,7 +828,7 @@ int process_pass(vw& all, bfgs& b) {
                       fprintf(stderr, "%2lu %-10.5f\t", (long unsigned int)b.current_pass+1, b.loss_sum / b.importance_weight_sum);
                   }
 		  double wolfe1;
-		  double new_step = wolfe_eval(all, b, b.mem, b.loss_sum, b.previous_loss_sum, b.step_size, b.importance_weight_sum, b.origin, wolfe1);
+		  double new_step = HISTORY_CALL(wolfe_eval, b.loss_sum, b.previous_loss_sum, b.step_size, b.importance_weight_sum, b.origin, wolfe1);
 
   /********************************************************************/
   /* B0) DERIVATIVE ZERO: MINIMUM FOUND *******************************/
@@ -648,7 +877,7 @@ int process_pass(vw& all, bfgs& b) {
 		      b.step_size = 1.0;
 
 		      try {
-			bfgs_iter_middle(all, b, b.mem, b.rho, b.alpha, b.lastj, b.origin);
+			HISTORY_CALL(bfgs_iter_middle, b.rho, b.alpha, b.lastj, b.origin);
 		      }
 		      catch (curv_exception e) {
 			fprintf(stdout, "In bfgs_iter_middle: %s", curv_message);
@@ -682,7 +911,7 @@ int process_pass(vw& all, bfgs& b) {
 		  }
 		  if (all.l2_lambda > 0.)
 		    b.curvature += regularizer_direction_magnitude(all, b, all.l2_lambda);
-		  float dd = (float)derivative_in_direction(all, b, b.mem, b.origin);
+		  float dd = (float)HISTORY_CALL(derivative_in_direction, b.origin);
 		  if (b.curvature == 0. && dd != 0.)
 		    {
 		      fprintf(stdout, "%s", curv_message);
@@ -737,6 +966,8 @@ void process_example(vw& all, bfgs& b, example& ec)
   /********************************************************************/ 
   if (b.gradient_pass)
     {
+      if (b.first_pass && b.mem_sparse)
+	mark_touched(all, b, ec);
       ec.final_prediction = predict_and_gradient(all, ec);//w[0] & w[1]
       ec.loss = all.loss->getLoss(all.sd, ec.final_prediction, ld->label) * ld->weight;
       b.loss_sum += ec.loss;
@@ -850,6 +1081,8 @@ void finish(bfgs& b)
   free(b.mem);
   free(b.rho);
   free(b.alpha);
+  free(b.mem_index);
+  free(b.touched);
 }
 
 void save_load_regularizer(vw& all, bfgs& b, io_buf& model_file, bool read, bool text)
@@ -922,13 +1155,27 @@ void save_load(bfgs& b, io_buf& model_file, bool read, bool text)
       int m = all->m;
       
       b.mem_stride = (m==0) ? CG_EXTRA : 2*m;
-      b.mem = (float*) malloc(sizeof(float)*all->length()*(b.mem_stride));
+      if (b.mem_sparse)
+	b.touched = (uint32_t*) calloc((length+31)/32, sizeof(uint32_t));
+      else
+	allocate_history(*all, b, length);
       b.rho = (double*) malloc(sizeof(double)*m);
       b.alpha = (double*) malloc(sizeof(double)*m);
       
       if (!all->quiet) 
 	{
-	  fprintf(stderr, "m = %d\nAllocated %luM for weights and mem\n", m, (long unsigned int)all->length()*(sizeof(float)*(b.mem_stride)+sizeof(weight)*all->reg.stride) >> 20);
+	  size_t weight_bytes = sizeof(weight)*all->reg.stride*all->length();
+	  size_t mem_bytes = b.mem_sparse ? 0 : history_bytes(b, length);
+	  fprintf(stderr, "m = %d\nAllocated %luM for weights and mem\n", m, (long unsigned int)(weight_bytes + mem_bytes) >> 20);
+	  fprintf(stderr, "weights: %luM, ", (long unsigned int)weight_bytes >> 20);
+	  if (b.mem_sparse)
+	    fprintf(stderr, "history: after first pass (sparse, %s), first pass bitmap: %luM",
+		    b.mem_bf16 ? "bf16" : "float", (long unsigned int)(sizeof(uint32_t)*((length+31)/32)) >> 20);
+	  else
+	    fprintf(stderr, "history: %luM (dense, %s)", (long unsigned int)mem_bytes >> 20, b.mem_bf16 ? "bf16" : "float");
+	  if (b.regularizers != NULL)
+	    fprintf(stderr, ", regularizers: %luM", (long unsigned int)(2*length*sizeof(weight)) >> 20);
+	  fprintf(stderr, "\n");
 	}
       
       b.net_time = 0.0;
@@ -995,6 +1242,13 @@ learner* setup(vw& all, std::vector<std::string>&opts, po::variables_map& vm, po
   if (vm.count("hessian_on") || all.m==0) {
     all.hessian_on = true;
   }
+  b->mem_bf16 = vm.count("mem_bf16") > 0;
+  b->mem_sparse = vm.count("mem_sparse") > 0;
+  if (b->mem_sparse && all.span_server != "")
+    {
+      cerr << "warning: --mem_sparse is not supported with --span_server, using dense bfgs history" << endl;
+      b->mem_sparse = false;
+    }
   if (!all.quiet) {
     if (all.m>0)
       cerr << "enabling BFGS based optimization ";
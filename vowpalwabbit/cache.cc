@@ -6,6 +6,7 @@ license as described in the file LICENSE.
 #include "cache.h"
 #include "unique_sort.h"
 #include "global_data.h"
+#include "rand48.h"
 
 using namespace std;
 
@@ -200,3 +201,152 @@ void cache_features(io_buf& cache, example* ae, uint32_t mask)
   for (unsigned char* b = ae->indices.begin; b != ae->indices.end; b++)
     output_features(cache, *b, ae->atomics[*b].begin,ae->atomics[*b].end, mask);
 }
+
+example_store* new_store(size_t cap, bool shuffle, bool backed)
+{
+  example_store* s = new example_store();
+  s->cap = cap;
+  s->shuffle = shuffle;
+  s->backed = backed;
+  s->recording = true;
+  s->seed = 0x5e17ab1e;
+  return s;
+}
+
+void delete_store(example_store* s)
+{
+  s->examples.delete_v();
+  s->units.delete_v();
+  s->perm.delete_v();
+  s->order.delete_v();
+  s->scratch.delete_v();
+  delete s;
+}
+
+void store_example(example_store& s, label_parser& lp, example* ae, uint32_t in_pass_counter)
+{
+  stored_example r;
+  r.begin = s.arena.space.size();
+  lp.cache_label(ae->ld, s.arena);
+  cache_tag(s.arena, ae->tag);
+  r.features = s.arena.space.size();
+  r.in_pass_counter = in_pass_counter;
+  r.newline = example_is_newline(*ae) != 0;
+
+  char* c;
+  buf_write(s.arena, c, 2);
+  *c++ = (char)ae->sorted;
+  *c++ = (char)ae->indices.size();
+  for (unsigned char* b = ae->indices.begin; b != ae->indices.end; b++)
+    {
+      v_array<feature>& fs = ae->atomics[*b];
+      uint32_t n = (uint32_t)fs.size();
+      buf_write(s.arena, c, sizeof(*b) + sizeof(n) + sizeof(float) + n*sizeof(feature));
+      *c++ = *b;
+      memcpy(c, &n, sizeof(n));
+      c += sizeof(n);
+      memcpy(c, ae->sum_feat_sq + *b, sizeof(float));
+      c += sizeof(float);
+      memcpy(c, fs.begin, n*sizeof(feature));
+    }
+  s.examples.push_back(r);
+}
+
+void seal_store(example_store& s)
+{
+  s.recording = false;
+  s.arena.endloaded = s.arena.space.end;
+
+  // multiline examples end at a newline and must stay together when shuffled
+  bool multiline = false;
+  for (stored_example* r = s.examples.begin; r != s.examples.end; r++)
+    multiline |= r->newline;
+  for (size_t i = 0; i < s.examples.size(); i++)
+    if (!multiline || i == 0 || s.examples[i-1].newline)
+      s.units.push_back(i);
+
+  for (size_t i = 0; i < s.examples.size(); i++)
+    s.order.push_back(i);
+  for (size_t i = 0; i < s.units.size(); i++)
+    s.perm.push_back(i);
+}
+
+void start_memory_pass(example_store& s)
+{
+  s.next = 0;
+  if (!s.shuffle)
+    return;
+
+  for (size_t i = s.perm.size(); i > 1; i--)
+    {
+      size_t j = min((size_t)(merand48(s.seed) * i), i-1);
+      size_t t = s.perm[i-1]; s.perm[i-1] = s.perm[j]; s.perm[j] = t;
+    }
+  s.order.erase();
+  for (size_t* u = s.perm.begin; u != s.perm.end; u++)
+    {
+      size_t end = *u+1 < s.units.size() ? s.units[*u+1] : s.examples.size();
+      for (size_t i = s.units[*u]; i < end; i++)
+	s.order.push_back(i);
+    }
+}
+
+// re-encode everything stored so far as a regular cache file
+void write_store(example_store& s, io_buf& cache, uint32_t mask)
+{
+  for (size_t i = 0; i < s.examples.size(); i++)
+    {
+      stored_example& r = s.examples[i];
+      char* c;
+      size_t len = r.features - r.begin;
+      buf_write(cache, c, len);
+      memcpy(c, s.arena.space.begin + r.begin, len);
+
+      char* p = s.arena.space.begin + r.features + 1;
+      unsigned char num_indices = *p++;
+      output_byte(cache, num_indices);
+      for (; num_indices > 0; num_indices--)
+	{
+	  unsigned char index = *p++;
+	  uint32_t n;
+	  memcpy(&n, p, sizeof(n));
+	  p += sizeof(n) + sizeof(float);
+	  s.scratch.erase();
+	  push_many(s.scratch, (feature*)p, n);
+	  p += n*sizeof(feature);
+	  output_features(cache, index, s.scratch.begin, s.scratch.end, mask);
+	}
+    }
+}
+
+int read_memory_features(void* in, example* ec)
+{
+  vw* all = (vw*)in;
+  example_store& s = *all->p->store;
+  if (s.next == s.order.size())
+    return 0;
+
+  stored_example& r = s.examples[s.order[s.next++]];
+  memory_buf& arena = s.arena;
+  arena.space.end = arena.space.begin + r.begin;
+  if (all->p->lp.read_cached_label(all->sd, ec->ld, arena) == 0 || read_cached_tag(arena, ec) == 0)
+    return 0;
+  all->p->in_pass_counter = r.in_pass_counter;
+
+  char* c = arena.space.begin + r.features;
+  ec->sorted = *c++ != 0;
+  unsigned char num_indices = *c++;
+  for (; num_indices > 0; num_indices--)
+    {
+      unsigned char index = *c++;
+      uint32_t n;
+      memcpy(&n, c, sizeof(n));
+      c += sizeof(n);
+      ec->indices.push_back(index);
+      memcpy(ec->sum_feat_sq + index, c, sizeof(float));
+      c += sizeof(float);
+      push_many(ec->atomics[index], (feature*)c, n);
+      c += n*sizeof(feature);
+    }
+  return (int)(c - (arena.space.begin + r.begin));
+}
@@ -20,4 +20,44 @@ void cache_features(io_buf& cache, example* ae, uint32_t mask);
 void output_byte(io_buf& cache, unsigned char s);
 void output_features(io_buf& cache, unsigned char index, feature* begin, feature* end, uint32_t mask);
 
+// --in_memory keeps the examples of the first pass so later passes need no
+// cache file.  labels and tags use the cache encoding, features are stored as
+// flat arrays so that replaying an example is a copy rather than a decode.
+class memory_buf : public io_buf {
+ public:
+  virtual void flush() { // nothing to write out to, so grow instead
+    space.resize(2 * (space.end_array - space.begin));
+  }
+};
+
+struct stored_example {
+  size_t begin;             // offset of the cached label in the arena
+  size_t features;          // offset of the feature block
+  uint32_t in_pass_counter; // position in the first pass, keeps the holdout set fixed
+  bool newline;
+};
+
+struct example_store {
+  memory_buf arena;
+  v_array<stored_example> examples;
+  v_array<size_t> units;    // first example of each unit a shuffle may move
+  v_array<size_t> perm;
+  v_array<size_t> order;    // replay order of the current pass
+  v_array<feature> scratch;
+  size_t next;
+  size_t cap;               // arena bytes before spilling to a cache file, 0 for no limit
+  bool backed;              // a cache file already made the source resettable
+  bool recording;
+  bool shuffle;
+  uint64_t seed;
+};
+
+example_store* new_store(size_t cap, bool shuffle, bool backed);
+void delete_store(example_store* s);
+void store_example(example_store& s, label_parser& lp, example* ae, uint32_t in_pass_counter);
+void seal_store(example_store& s);
+void start_memory_pass(example_store& s);
+void write_store(example_store& s, io_buf& cache, uint32_t mask);
+int read_memory_features(void* a, example* ec);
+
 #endif
@@ -24,6 +24,7 @@ namespace CB_ALGS
   struct cb {
     size_t cb_type;
     COST_SENSITIVE::label cb_cs_ld; 
+    v_array<float> pred_costs; //regressor predictions of the example's actions, from the first one on
     float avg_loss_regressors;
     size_t nb_ex_regressors;
     float last_pred_reg;
@@ -136,11 +137,42 @@ namespace CB_ALGS
 
   }
 
+  //fills c.pred_costs with the regressor predictions of the actions ec
+  //allows, computed in one pass over its features, and updates the
+  //regressor of the observed action.  Returns the first action.
+  template <bool is_learn>
+  uint32_t get_cost_preds(vw& all, cb& c, example& ec, uint32_t base)
+  {
+    CB::label* ld = (CB::label*)ec.ld;
+
+    uint32_t lo = 1, hi = (uint32_t)all.sd->k;
+    if (ld->costs.size() > 1)
+      {
+	lo = hi = ld->costs[0].action;
+	for (cb_class* cl = ld->costs.begin; cl != ld->costs.end; cl++)
+	  {
+	    lo = min(lo, cl->action);
+	    hi = max(hi, cl->action);
+	  }
+      }
+
+    c.pred_costs.erase();
+    for (uint32_t i = lo; i <= hi; i++)
+      c.pred_costs.push_back(0.);
+    CB_ALGS::get_cost_preds(all, ec, lo, hi - lo + 1, base, c.pred_costs.begin);
+
+    if (is_learn && c.known_cost != NULL && c.known_cost->action >= lo && c.known_cost->action <= hi)
+      c.pred_costs[c.known_cost->action - lo] = get_cost_pred<true>(all, c.known_cost, ec, c.known_cost->action, base);
+
+    return lo;
+  }
+
   template <bool is_learn>
   void gen_cs_example_dm(vw& all, cb& c, example& ec, COST_SENSITIVE::label& cs_ld)
   {
     //this implements the direct estimation method, where costs are directly specified by the learned regressor.
     CB::label* ld = (CB::label*)ec.ld;
+    uint32_t lo = get_cost_preds<is_learn>(all, c, ec, 0);
 
     float min = FLT_MAX;
     size_t argmin = 1;
@@ -154,7 +186,7 @@ namespace CB_ALGS
         wc.wap_value = 0.;
       
         //get cost prediction for this action
-        wc.x = get_cost_pred<is_learn>(all, c.known_cost, ec, i, 0);
+        wc.x = c.pred_costs[i - lo];
 	if (wc.x < min)
 	  {
 	    min = wc.x;
@@ -183,7 +215,7 @@ namespace CB_ALGS
         wc.wap_value = 0.;
       
         //get cost prediction for this action
-        wc.x = get_cost_pred<is_learn>(all, c.known_cost, ec, cl->action, 0);
+        wc.x = c.pred_costs[cl->action - lo];
 	if (wc.x < min || (wc.x == min && cl->action < argmin))
 	  {
 	    min = wc.x;
@@ -208,14 +240,13 @@ namespace CB_ALGS
     ec.final_prediction = (float)argmin;
   }
 
-  template <bool is_learn>
-  void gen_cs_label(vw& all, cb& c, example& ec, COST_SENSITIVE::label& cs_ld, uint32_t label)
+  void gen_cs_label(vw& all, cb& c, example& ec, COST_SENSITIVE::label& cs_ld, uint32_t label, float cost_pred)
   {
     COST_SENSITIVE::wclass wc;
     wc.wap_value = 0.;
     
-    //get cost prediction for this label
-    wc.x = get_cost_pred<is_learn>(all, c.known_cost, ec, label, all.sd->k);
+    //cost prediction for this label
+    wc.x = cost_pred;
     wc.weight_index = label;
     wc.partial_prediction = 0.;
     wc.wap_value = 0.;
@@ -235,17 +266,18 @@ namespace CB_ALGS
   void gen_cs_example_dr(vw& all, cb& c, example& ec, COST_SENSITIVE::label& cs_ld)
   {//this implements the doubly robust method
     CB::label* ld = (CB::label*)ec.ld;
+    uint32_t lo = get_cost_preds<is_learn>(all, c, ec, (uint32_t)all.sd->k);
     
     //generate cost sensitive example
     cs_ld.costs.erase();
     if( ld->costs.size() == 1) //this is a typical example where we can perform all actions
       //in this case generate cost-sensitive example with all actions
       for(uint32_t i = 1; i <= all.sd->k; i++)
-	gen_cs_label<is_learn>(all, c, ec, cs_ld, i);
+	gen_cs_label(all, c, ec, cs_ld, i, c.pred_costs[i - lo]);
     else  //this is an example where we can only perform a subset of the actions
       //in this case generate cost-sensitive example with only allowed actions
       for( cb_class* cl = ld->costs.begin; cl != ld->costs.end; cl++ )
-	gen_cs_label<is_learn>(all, c, ec, cs_ld, cl->action);
+	gen_cs_label(all, c, ec, cs_ld, cl->action, c.pred_costs[cl->action - lo]);
   }
 
   void cb_test_to_cs_test_label(vw& all, example& ec, COST_SENSITIVE::label& cs_ld)
@@ -467,6 +499,7 @@ namespace CB_ALGS
   void finish(cb& c)
   {
     c.cb_cs_ld.costs.delete_v();
+    c.pred_costs.delete_v();
   }
 
   void finish_example(vw& all, cb& c, example& ec)
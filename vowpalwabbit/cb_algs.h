@@ -39,6 +39,22 @@ namespace CB_ALGS {
 
     return ec.final_prediction;
   }
+
+  //the cost predictions of actions lo .. lo+count-1 in one pass over the
+  //features, without learning
+  inline void get_cost_preds(vw& all, example& ec, uint32_t lo, uint32_t count, uint32_t base, float* preds)
+  {
+    void* ld = ec.ld;
+
+    label_data simple_temp;
+    simple_temp.initial = 0.;
+    simple_temp.label = FLT_MAX;
+    simple_temp.weight = 0.;
+
+    ec.ld = &simple_temp;
+    all.scorer->multipredict(ec, lo-1+base, count, preds);
+    ec.ld = ld;
+  }
 }
 
 #endif
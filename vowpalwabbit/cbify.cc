@@ -23,6 +23,7 @@ namespace CBIFY {
     size_t bags;
     v_array<float> count;
     v_array<uint32_t> predictions;
+    v_array<float> cost_preds;
     
     CB::label cb_label;
     COST_SENSITIVE::label cs_label;
@@ -186,12 +187,12 @@ namespace CBIFY {
       }
   }
 
-  void gen_cs_label(vw& all, CB::cb_class& known_cost, example& ec, COST_SENSITIVE::label& cs_ld, uint32_t label)
+  void gen_cs_label(CB::cb_class& known_cost, COST_SENSITIVE::label& cs_ld, uint32_t label, float cost_pred)
   {
     COST_SENSITIVE::wclass wc;
     
-    //get cost prediction for this label
-    wc.x = CB_ALGS::get_cost_pred<false>(all, &known_cost, ec, label, all.sd->k);
+    //cost prediction for this label
+    wc.x = cost_pred;
     wc.weight_index = label;
     wc.partial_prediction = 0.;
     wc.wap_value = 0.;
@@ -261,9 +262,10 @@ namespace CBIFY {
 	//1. Compute loss vector
 	data.cs_label.costs.erase();
 	float norm = min_prob * data.k;
+	CB_ALGS::get_cost_preds(*data.all, ec, 1, (uint32_t)data.k, (uint32_t)data.all->sd->k, data.cost_preds.begin);
 	for (uint32_t j = 0; j < data.k; j++)
 	  { //data.cs_label now contains an unbiased estimate of cost of each class.
-	    gen_cs_label(*data.all, l, ec, data.cs_label, j+1);
+	    gen_cs_label(l, data.cs_label, j+1, data.cost_preds[j]);
 	    data.count[j] = 0;
 	  }
 	
@@ -349,6 +351,7 @@ namespace CBIFY {
 	data->cs = all.cost_sensitive;
 	data->count.resize(data->k);
 	data->predictions.resize(data->bags);
+	data->cost_preds.resize(data->k);
 	data->second_cs_label.costs.resize(data->k);
 	data->second_cs_label.costs.end = data->second_cs_label.costs.begin+data->k;
 	if ( vm.count("epsilon") ) 
@@ -8,7 +8,6 @@ license as described in the file LICENSE.
 #include "reductions.h"
 #include "cost_sensitive.h"
 #include "simple_label.h"
-#include "v_hashmap.h"
 
 using namespace std;
 
@@ -99,9 +98,25 @@ namespace CSOAA {
 
 namespace CSOAA_AND_WAP_LDF {
 
+  // label -> features table for label definitions.  all features live in
+  // one contiguous pool; each open-addressed slot just records the [begin,end)
+  // offsets of its label's span, so there is no per-label allocation.
+  struct label_slot {
+    size_t lab;
+    size_t begin;
+    size_t end;
+    bool   occupied;
+  };
+
+  struct label_feature_table {
+    v_array<label_slot> slots;   // power-of-two sized
+    v_array<feature> pool;
+    size_t num_labels;
+  };
+
   struct ldf {
     v_array<example*> ec_seq;
-    v_hashmap< size_t, v_array<feature> > label_features;
+    label_feature_table label_features;
 
     size_t read_example_this_loop;
     bool need_to_clear;
@@ -116,10 +131,60 @@ namespace CSOAA_AND_WAP_LDF {
   };
 
 namespace LabelDict { 
-  bool size_t_eq(size_t a, size_t b) { return (a==b); }
+  inline size_t hash_lab(size_t lab) { return 328051 + 94389193 * lab; }
+
+  void init(label_feature_table& t, size_t min_size) {
+    size_t sz = 1;
+    while (sz < min_size) sz <<= 1;
+    t.slots.resize(sz, true);
+    t.slots.end = t.slots.end_array;
+    t.pool.erase();
+    t.num_labels = 0;
+  }
+
+  // returns the slot holding lab, or the empty slot where it would go
+  inline label_slot& find_slot(label_feature_table& t, size_t lab) {
+    size_t mask = t.slots.size() - 1;
+    size_t i = hash_lab(lab) & mask;
+    while (t.slots[i].occupied && t.slots[i].lab != lab)
+      i = (i+1) & mask;
+    return t.slots[i];
+  }
+
+  void double_size(label_feature_table& t) {
+    v_array<label_slot> old = t.slots;
+    t.slots = v_array<label_slot>();
+    t.slots.resize(2 * old.size(), true);
+    t.slots.end = t.slots.end_array;
+    for (label_slot* s = old.begin; s != old.end; s++)
+      if (s->occupied)
+        find_slot(t, s->lab) = *s;
+    old.delete_v();
+  }
+
+  bool contains(label_feature_table& t, size_t lab) { return find_slot(t, lab).occupied; }
+
+  // the returned span is only valid until the next insertion into the pool
+  inline bool get_label_features(label_feature_table& t, size_t lab, feature*& begin, feature*& end) {
+    label_slot& s = find_slot(t, lab);
+    if (!s.occupied || s.begin == s.end) return false;
+    begin = t.pool.begin + s.begin;
+    end   = t.pool.begin + s.end;
+    return true;
+  }
+
+  void put_span(label_feature_table& t, size_t lab, size_t begin, size_t end) {
+    if (2 * (t.num_labels+1) > t.slots.size())   // keep the load factor at or below one half
+      double_size(t);
+    label_slot& s = find_slot(t, lab);
+    if (s.occupied) return;
+    s.occupied = true;
+    s.lab = lab;
+    s.begin = begin;
+    s.end = end;
+    t.num_labels++;
+  }
 
-  size_t hash_lab(size_t lab) { return 328051 + 94389193 * lab; }
-  
   bool ec_is_label_definition(example& ec) // label defs look like "___:-1"
   {
     v_array<COST_SENSITIVE::wclass> costs = ((COST_SENSITIVE::label*)ec.ld)->costs;
@@ -155,8 +220,8 @@ namespace LabelDict {
     return is_lab;
   }
 
-  void del_example_namespace(example& ec, char ns, v_array<feature> features) {
-    size_t numf = features.size();
+  void del_example_namespace(example& ec, char ns, feature* begin, feature* end) {
+    size_t numf = end - begin;
     ec.num_features -= numf;
 
     assert (ec.atomics[(size_t)ns].size() >= numf);
@@ -168,14 +233,14 @@ namespace LabelDict {
       ec.atomics[(size_t)ns].erase();
       ec.sum_feat_sq[(size_t)ns] = 0.;
     } else { // DID have ns
-      for (feature*f=features.begin; f!=features.end; f++) {
+      for (feature*f=begin; f!=end; f++) {
         ec.sum_feat_sq[(size_t)ns] -= f->x * f->x;
         ec.atomics[(size_t)ns].pop();
       }
     }
   }
 
-  void add_example_namespace(example& ec, char ns, v_array<feature> features) {
+  void add_example_namespace(example& ec, char ns, feature* begin, feature* end) {
     bool has_ns = false;
     for (size_t i=0; i<ec.indices.size(); i++) {
       if (ec.indices[i] == (size_t)ns) {
@@ -190,12 +255,11 @@ namespace LabelDict {
       ec.sum_feat_sq[(size_t)ns] = 0;
     }
 
-    for (feature*f=features.begin; f!=features.end; f++) {
+    for (feature*f=begin; f!=end; f++)
       ec.sum_feat_sq[(size_t)ns] += f->x * f->x;
-      ec.atomics[(size_t)ns].push_back(*f);
-    }
+    push_many(ec.atomics[(size_t)ns], begin, end - begin);
 
-    ec.num_features += features.size();
+    ec.num_features += end - begin;
     ec.total_sum_feat_sq += ec.sum_feat_sq[(size_t)ns];
   }
 
@@ -204,7 +268,7 @@ namespace LabelDict {
   void add_example_namespaces_from_example(example& target, example& source) {
     for (unsigned char* idx=source.indices.begin; idx!=source.indices.end; idx++) {
       if (*idx == constant_namespace) continue;
-      add_example_namespace(target, (char)*idx, source.atomics[*idx]);
+      add_example_namespace(target, (char)*idx, source.atomics[*idx].begin, source.atomics[*idx].end);
     }
   }
 
@@ -214,41 +278,42 @@ namespace LabelDict {
     idx--;
     for (; idx>=source.indices.begin; idx--) {
       if (*idx == constant_namespace) continue;
-      del_example_namespace(target, (char)*idx, source.atomics[*idx]);
+      del_example_namespace(target, (char)*idx, source.atomics[*idx].begin, source.atomics[*idx].end);
     }
   }
 
   void add_example_namespace_from_memory(ldf& l, example& ec, size_t lab) {
-    size_t lab_hash = hash_lab(lab);
-    v_array<feature> features = l.label_features.get(lab, lab_hash);
-    if (features.size() == 0) return;
-    add_example_namespace(ec, 'l', features);
+    feature *begin, *end;
+    if (!get_label_features(l.label_features, lab, begin, end)) return;
+    add_example_namespace(ec, 'l', begin, end);
   }
 
   void del_example_namespace_from_memory(ldf& l, example& ec, size_t lab) {
-    size_t lab_hash = hash_lab(lab);
-    v_array<feature> features = l.label_features.get(lab, lab_hash);
-    if (features.size() == 0) return;
-    del_example_namespace(ec, 'l', features);
-  }
-
-  void set_label_features(ldf& l, size_t lab, v_array<feature>features) {
-    size_t lab_hash = hash_lab(lab);
-    if (l.label_features.contains(lab, lab_hash)) { return; }
-    l.label_features.put_after_get(lab, lab_hash, features);
+    feature *begin, *end;
+    if (!get_label_features(l.label_features, lab, begin, end)) return;
+    del_example_namespace(ec, 'l', begin, end);
+  }
+
+  // copies the features into the pool once and points every new label at that span
+  void set_label_features(ldf& l, v_array<COST_SENSITIVE::wclass>& costs, feature* begin, feature* end) {
+    label_feature_table& t = l.label_features;
+    size_t span_begin = t.pool.size();
+    bool copied = false;
+    for (size_t j=0; j<costs.size(); j++) {
+      size_t lab = costs[j].weight_index;
+      if (contains(t, lab)) continue;
+      if (!copied) {
+        push_many(t.pool, begin, end - begin);
+        copied = true;
+      }
+      put_span(t, lab, span_begin, t.pool.size());
+    }
   }
 
   void free_label_features(ldf& l) {
-    void* label_iter = l.label_features.iterator();
-    while (label_iter != NULL) {
-      v_array<feature> *features = l.label_features.iterator_get_value(label_iter);
-      features->erase();
-      features->delete_v();
-
-      label_iter = l.label_features.iterator_next(label_iter);
-    }
-    l.label_features.clear();
-    l.label_features.delete_v();
+    l.label_features.slots.delete_v();
+    l.label_features.pool.delete_v();
+    l.label_features.num_labels = 0;
   }
 }
 
@@ -552,17 +617,9 @@ namespace LabelDict {
     /////////////////////// handle label definitions
     if (LabelDict::ec_seq_is_label_definition(l, l.ec_seq)) {
       for (size_t i=0; i<l.ec_seq.size(); i++) {
-        v_array<feature> features;
-        for (feature*f=l.ec_seq[i]->atomics[l.ec_seq[i]->indices[0]].begin; f!=l.ec_seq[i]->atomics[l.ec_seq[i]->indices[0]].end; f++) {
-          feature fnew = { f->x,  f->weight_index };
-          features.push_back(fnew);
-        }
-
-        v_array<COST_SENSITIVE::wclass> costs = ((COST_SENSITIVE::label*)l.ec_seq[i]->ld)->costs;
-        for (size_t j=0; j<costs.size(); j++) {
-          size_t lab = costs[j].weight_index;
-          LabelDict::set_label_features(l, lab, features);
-        }
+        v_array<feature>& features = l.ec_seq[i]->atomics[l.ec_seq[i]->indices[0]];
+        v_array<COST_SENSITIVE::wclass>& costs = ((COST_SENSITIVE::label*)l.ec_seq[i]->ld)->costs;
+        LabelDict::set_label_features(l, costs, features.begin, features.end);
       }
       return;
     }
@@ -862,8 +919,7 @@ namespace LabelDict {
     if (all.add_constant) {
       all.add_constant = false;
     }
-    ld->label_features.init(256, v_array<feature>(), LabelDict::size_t_eq);
-    ld->label_features.get(1, 94717244); // TODO: figure this out
+    LabelDict::init(ld->label_features, 256);
 
     ld->read_example_this_loop = 0;
     ld->need_to_clear = false;
@@ -101,6 +101,7 @@ example *alloc_examples(size_t label_size, size_t count=1)
     }
     ec[i].in_use = true;
     ec[i].ft_offset = 0;
+    ec[i].difference_offset = 0;
     //  std::cerr << "  alloc_example.indices.begin=" << ec->indices.begin << " end=" << ec->indices.end << " // ld = " << ec->ld << "\t|| me = " << ec << std::endl;
   }
   return ec;
@@ -177,6 +178,7 @@ void copy_example_data(bool audit, example* dst, example* src)
   for (size_t i=0; i<256; i++)
     copy_array(dst->atomics[i], src->atomics[i]);
   dst->ft_offset = src->ft_offset;
+  dst->difference_offset = src->difference_offset;
 
   if (audit)
     for (size_t i=0; i<256; i++)
@@ -45,6 +45,7 @@ struct example // core example datatype.
   v_array<unsigned char> indices;
   v_array<feature> atomics[256]; // raw parsed data
   uint32_t ft_offset;
+  uint32_t difference_offset;//if nonzero, the features count again, negated, this far past ft_offset.
   
   v_array<audit_data> audit_features[256];
   
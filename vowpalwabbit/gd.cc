@@ -287,6 +287,12 @@ void print_features(vw& all, example& ec)
 	audit_features(all, ec.atomics[*i], ec.audit_features[*i], features, empty, ns_pre, ec.ft_offset);
         ns_pre = "";
       }
+      if (ec.difference_offset != 0)
+        for (unsigned char* i = ec.indices.begin; i != ec.indices.end; i++){
+          ns_pre = "";
+          audit_features(all, ec.atomics[*i], ec.audit_features[*i], features, "-", ns_pre, ec.ft_offset + ec.difference_offset, -1.);
+          ns_pre = "";
+        }
       for (vector<string>::iterator i = all.pairs.begin(); i != all.pairs.end();i++) 
 	{
 	  int fst = (*i)[0];
@@ -434,6 +440,106 @@ void predict(gd& g, learner& base, example& ec)
     print_audit_features(all, ec);
 }
 
+// the predictions of count problems, step weights apart, share one pass
+// over the features; T adds a feature to one of them
+template <class R>
+struct multipredict_data {
+  R* pred;
+  size_t count;
+  size_t step;
+  weight* weights;
+  size_t mask;
+};
+
+template <class R, void (*T)(R&, const float, float&)>
+inline void vec_add_multipredict(multipredict_data<R>& mp, const float fx, float& fw)
+{
+  size_t i = &fw - mp.weights;
+  if (i + (mp.count-1)*mp.step <= mp.mask)
+    {
+      weight* w = &fw;
+      for (size_t c = 0; c < mp.count; c++, w += mp.step)
+	T(mp.pred[c], fx, *w);
+    }
+  else
+    for (size_t c = 0; c < mp.count; c++)
+      T(mp.pred[c], fx, mp.weights[(i + c*mp.step) & mp.mask]);
+}
+
+// foreach_feature for multipredict.  Moving ft_offset by step moves a
+// pair or triple weight by a multiple of step, which is what mp.step is
+// set to for those.
+template <class R, void (*T)(R&, const float, float&)>
+void foreach_feature_multi(vw& all, example& ec, multipredict_data<R>& mp)
+{
+  uint32_t offset = ec.ft_offset;
+  uint32_t step = (uint32_t)mp.step;
+
+  for (unsigned char* i = ec.indices.begin; i != ec.indices.end; i++)
+    foreach_feature<multipredict_data<R>, vec_add_multipredict<R,T> >(all.reg.weight_vector, all.reg.weight_mask, ec.atomics[*i].begin, ec.atomics[*i].end, mp, offset);
+
+  mp.step = (uint32_t)(quadratic_constant * step);
+  for (vector<string>::iterator i = all.pairs.begin(); i != all.pairs.end();i++)
+    for (feature* f = ec.atomics[(int)(*i)[0]].begin; f != ec.atomics[(int)(*i)[0]].end; f++)
+      {
+	uint32_t halfhash = quadratic_constant * (f->weight_index + offset);
+	foreach_feature<multipredict_data<R>, vec_add_multipredict<R,T> >(all.reg.weight_vector, all.reg.weight_mask, ec.atomics[(int)(*i)[1]].begin, ec.atomics[(int)(*i)[1]].end, mp, halfhash, f->x);
+      }
+
+  mp.step = (uint32_t)(cubic_constant2 * (cubic_constant * step + step));
+  for (vector<string>::iterator i = all.triples.begin(); i != all.triples.end();i++)
+    for (feature* f1 = ec.atomics[(int)(*i)[0]].begin; f1 != ec.atomics[(int)(*i)[0]].end; f1++)
+      for (feature* f2 = ec.atomics[(int)(*i)[1]].begin; f2 != ec.atomics[(int)(*i)[1]].end; f2++)
+	{
+	  uint32_t halfhash = cubic_constant2 * (cubic_constant * (f1->weight_index + offset) + f2->weight_index + offset);
+	  foreach_feature<multipredict_data<R>, vec_add_multipredict<R,T> >(all.reg.weight_vector, all.reg.weight_mask, ec.atomics[(int)(*i)[2]].begin, ec.atomics[(int)(*i)[2]].end, mp, halfhash, f1->x * f2->x);
+	}
+
+  mp.step = step;
+}
+
+template<bool normalized_training, bool reg_mode_odd, bool power_t_half>
+void multipredict(gd& g, learner& base, example& ec, size_t count, size_t step, float* pred)
+{
+  vw& all = *g.all;
+
+  // truncated and general power_t predictions, and audit output, are made
+  // one problem at a time
+  if (reg_mode_odd || (normalized_training && !power_t_half) || all.audit || all.hash_inv)
+    {
+      for (size_t c = 0; c < count; c++)
+	{
+	  predict<normalized_training, reg_mode_odd, power_t_half>(g, base, ec);
+	  pred[c] = ec.final_prediction;
+	  ec.ft_offset += (uint32_t)step;
+	}
+      ec.ft_offset -= (uint32_t)(step*count);
+      return;
+    }
+
+  label_data* ld = (label_data*)ec.ld;
+  for (size_t c = 0; c < count; c++)
+    pred[c] = ld->initial;
+  multipredict_data<float> mp = {pred, count, step, all.reg.weight_vector, all.reg.weight_mask};
+
+  if (normalized_training)
+    if (all.adaptive)
+      if (all.normalized_idx == 1)
+	foreach_feature_multi<float, vec_add_rescale<true, 1> >(all, ec, mp);
+      else
+	foreach_feature_multi<float, vec_add_rescale<true, 2> >(all, ec, mp);
+    else
+      if (all.normalized_idx == 1)
+	foreach_feature_multi<float, vec_add_rescale<false, 1> >(all, ec, mp);
+      else
+	foreach_feature_multi<float, vec_add_rescale<false, 2> >(all, ec, mp);
+  else
+    foreach_feature_multi<float, vec_add>(all, ec, mp);
+
+  for (size_t c = 0; c < count; c++)
+    pred[c] = finalize_prediction(all, pred[c] * (float)all.sd->contraction);
+}
+
   struct norm_data {
     float g;
     float norm;
@@ -566,7 +672,7 @@ void local_predict(vw& all, gd& g, example& ec)
             else
 	      norm = compute_norm<powert_norm_compute<adaptive, normalized, feature_mask_off, normalized_idx, feature_mask_idx> >(all,ec);
           else
-            norm = ec.total_sum_feat_sq;
+            norm = (ec.difference_offset != 0) ? 2.f * ec.total_sum_feat_sq : ec.total_sum_feat_sq;
 
           eta_t = all.eta * norm * ld->weight;
           if(!adaptive && all.power_t != 0) eta_t *= powf(t,-all.power_t);
@@ -896,6 +1002,7 @@ learner* setup(vw& all, po::variables_map& vm)
   }
 
   learner* ret = new learner(g, all.reg.stride);        //debug: gd learner; g=dat, stride=params_per_weight
+  ret->reads_features = false;
 
   // select the appropriate predict function based on normalization, regularization, and power_t
   if (all.normalized_updates && all.training)
@@ -905,6 +1012,7 @@ learner* setup(vw& all, po::variables_map& vm)
 	{
 	  g->predict = predict<true, true, true>;
 	  ret->set_predict<gd, predict<true, true, true> >();   
+	  ret->set_multipredict<gd, multipredict<true, true, true> >();
           /*     //debug: template<bool normalized_training, bool reg_mode_odd, bool power_t_half>
            *     learn_fd.predict_f = tlearn<gd,predict>;*/
           
@@ -916,17 +1024,20 @@ learner* setup(vw& all, po::variables_map& vm)
 	{
 	  g->predict = predict<true, true, false>;
 	  ret->set_predict<gd, predict<true, true, false> >();
+	  ret->set_multipredict<gd, multipredict<true, true, false> >();
 	}
     else
       if (all.power_t == 0.5)
 	{
 	  g->predict = predict<true, false, true>;
 	  ret->set_predict<gd, predict<true, false, true> >();
+	  ret->set_multipredict<gd, multipredict<true, false, true> >();
 	}
       else
 	{
 	  g->predict = predict<true, false, false>;
 	  ret->set_predict<gd, predict<true, false, false> >();
+	  ret->set_multipredict<gd, multipredict<true, false, false> >();
 	}
   else
     if (all.reg_mode % 2)
@@ -934,22 +1045,26 @@ learner* setup(vw& all, po::variables_map& vm)
 	{
 	  g->predict = predict<false, true, true>;
 	  ret->set_predict<gd, predict<false, true, true> >();
+	  ret->set_multipredict<gd, multipredict<false, true, true> >();
 	}
       else
 	{
 	  g->predict = predict<false, true, false>;
 	  ret->set_predict<gd, predict<false, true, false> >();
+	  ret->set_multipredict<gd, multipredict<false, true, false> >();
 	}
     else
       if (all.power_t == 0.5)   //debug: default = no normalize, reg mode even, power_t_half
 	{
 	  g->predict = predict<false, false, true>;
 	  ret->set_predict<gd, predict<false, false, true> >();
+	  ret->set_multipredict<gd, multipredict<false, false, true> >();
 	}
       else
 	{
 	  g->predict = predict<false, false, true>;
 	  ret->set_predict<gd, predict<false, false, true> >();
+	  ret->set_multipredict<gd, multipredict<false, false, true> >();
 	}
 
   // select the appropriate learn function based on adaptive, normalization, and feature mask
@@ -38,13 +38,11 @@ void output_and_account_example(example* ec);
        T(dat, mult*f->x, weight_vector[(f->weight_index + offset) & weight_mask]);
    }
 
- template <class R, void (*T)(R&, const float, float&)>
-   void foreach_feature(vw& all, example& ec, R& dat)
+ template <class R, void (*T)(R&, const float, float&), bool negated>
+   void foreach_feature(vw& all, example& ec, R& dat, uint32_t offset)
    {
-     uint32_t offset = ec.ft_offset;
-
-     for (unsigned char* i = ec.indices.begin; i != ec.indices.end; i++) 
-       foreach_feature<R,T>(all.reg.weight_vector, all.reg.weight_mask, ec.atomics[*i].begin, ec.atomics[*i].end, dat, offset);
+     for (unsigned char* i = ec.indices.begin; i != ec.indices.end; i++)
+       foreach_feature<R,T>(all.reg.weight_vector, all.reg.weight_mask, ec.atomics[*i].begin, ec.atomics[*i].end, dat, offset, negated ? -1.f : 1.f);
      
      for (vector<string>::iterator i = all.pairs.begin(); i != all.pairs.end();i++) {
        if (ec.atomics[(int)(*i)[0]].size() > 0) {
@@ -54,7 +52,7 @@ void output_and_account_example(example* ec);
 			 uint32_t halfhash = quadratic_constant * (temp.begin->weight_index + offset);
        
 			 foreach_feature<R,T>(all.reg.weight_vector, all.reg.weight_mask, ec.atomics[(int)(*i)[1]].begin, ec.atomics[(int)(*i)[1]].end, dat, 
-					halfhash, temp.begin->x);
+					halfhash, negated ? -temp.begin->x : temp.begin->x);
 		   }
        }
      }
@@ -68,12 +66,24 @@ void output_and_account_example(example* ec);
 	   
 	   uint32_t halfhash = cubic_constant2 * (cubic_constant * (temp1.begin->weight_index + offset) + temp2.begin->weight_index + offset);
 	   float mult = temp1.begin->x * temp2.begin->x;
+	   if (negated) mult = -mult;
 	   foreach_feature<R,T>(all.reg.weight_vector, all.reg.weight_mask, ec.atomics[(int)(*i)[2]].begin, ec.atomics[(int)(*i)[2]].end, dat, halfhash, mult);
 	 }
        }
      }
    }
 
+ // with a difference_offset, the example stands for its features at
+ // ft_offset less the same features that much further on, so learning on it
+ // trains the difference of two problems' weights (see wap)
+ template <class R, void (*T)(R&, const float, float&)>
+   void foreach_feature(vw& all, example& ec, R& dat)
+   {
+     foreach_feature<R,T,false>(all, ec, dat, ec.ft_offset);
+     if (ec.difference_offset != 0)
+       foreach_feature<R,T,true>(all, ec, dat, ec.ft_offset + ec.difference_offset);
+   }
+
  template <class R, void (*T)(predict_data<R>&, const float, float&)>
    float inline_predict(vw& all, example& ec, R extra)
    {
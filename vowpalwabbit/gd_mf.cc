@@ -109,25 +109,21 @@ float mf_predict(vw& all, example& ec)
     {
       if (ec.atomics[(int)(*i)[0]].size() > 0 && ec.atomics[(int)(*i)[1]].size() > 0)
 	{
-	  for (uint32_t k = 1; k <= all.rank; k++)
-	    {
-	      // x_l * l^k
-	      // l^k is from index+1 to index+all.rank
-	      //float x_dot_l = sd_offset_add(weights, mask, ec.atomics[(int)(*i)[0]].begin, ec.atomics[(int)(*i)[0]].end, k);
-              float x_dot_l = 0.;
-	      GD::foreach_feature<float, vec_add>(all.reg.weight_vector, all.reg.weight_mask, ec.atomics[(int)(*i)[0]].begin, ec.atomics[(int)(*i)[0]].end, x_dot_l, k);
-	      // x_r * r^k
-	      // r^k is from index+all.rank+1 to index+2*all.rank
-	      //float x_dot_r = sd_offset_add(weights, mask, ec.atomics[(int)(*i)[1]].begin, ec.atomics[(int)(*i)[1]].end, k+all.rank);
-              float x_dot_r = 0.;
-	      GD::foreach_feature<float,vec_add>(all.reg.weight_vector, all.reg.weight_mask, ec.atomics[(int)(*i)[1]].begin, ec.atomics[(int)(*i)[1]].end, x_dot_r, k+all.rank);
-
-	      prediction += x_dot_l * x_dot_r;
-
-	      // store prediction from interaction terms
-	      ec.topic_predictions.push_back(x_dot_l);
-	      ec.topic_predictions.push_back(x_dot_r);
-	    }
+	  size_t first = ec.topic_predictions.size();
+	  for (uint32_t k = 0; k < 2*all.rank; k++)
+	    ec.topic_predictions.push_back(0.f);
+	  float* x_dot_l = ec.topic_predictions.begin + first;
+	  float* x_dot_r = x_dot_l + all.rank;
+
+	  // x_l * l^k for every k in one sweep over the left namespace
+	  // l^k is from index+1 to index+all.rank
+	  sd_offset_rank_add(all.reg.weight_vector, all.reg.weight_mask, ec.atomics[(int)(*i)[0]].begin, ec.atomics[(int)(*i)[0]].end, 1, 1, all.rank, x_dot_l);
+	  // x_r * r^k
+	  // r^k is from index+all.rank+1 to index+2*all.rank
+	  sd_offset_rank_add(all.reg.weight_vector, all.reg.weight_mask, ec.atomics[(int)(*i)[1]].begin, ec.atomics[(int)(*i)[1]].end, 1+all.rank, 1, all.rank, x_dot_r);
+
+	  for (uint32_t k = 0; k < all.rank; k++)
+	    prediction += x_dot_l[k] * x_dot_r[k];
 	}
     }
 
@@ -136,7 +132,7 @@ float mf_predict(vw& all, example& ec)
     throw exception();
   }
 
-  // ec.topic_predictions has linear, x_dot_l_1, x_dot_r_1, x_dot_l_2, x_dot_r_2, ... 
+  // ec.topic_predictions has linear, then for each pair x_dot_l_1, ..., x_dot_l_rank, x_dot_r_1, ..., x_dot_r_rank
 
   ec.partial_prediction = prediction;
 
@@ -174,31 +170,36 @@ void mf_train(vw& all, example& ec, float update)
 	sd_offset_update(weights, mask, ec.atomics[*i].begin, ec.atomics[*i].end, 0, update, regularization);
       
       // quadratic update
+      // the per rank step sizes of a pair go past the stored predictions
+      size_t scaled = ec.topic_predictions.size();
+      for (uint32_t k = 0; k < 2*all.rank; k++)
+	ec.topic_predictions.push_back(0.f);
+
+      size_t first = 1;
       for (vector<string>::iterator i = all.pairs.begin(); i != all.pairs.end();i++) 
 	{
 	  if (ec.atomics[(int)(*i)[0]].size() > 0 && ec.atomics[(int)(*i)[1]].size() > 0)
 	    {
-
-	      // update l^k weights
-	      for (size_t k = 1; k <= all.rank; k++)
+	      float* x_dot_l = ec.topic_predictions.begin + first;
+	      float* x_dot_r = x_dot_l + all.rank;
+	      float* l_update = ec.topic_predictions.begin + scaled;
+	      float* r_update = l_update + all.rank;
+	      for (size_t k = 0; k < all.rank; k++)
 		{
-		  // r^k \cdot x_r
-		  float r_dot_x = ec.topic_predictions[2*k];
-		  // l^k <- l^k + update * (r^k \cdot x_r) * x_l
-		  sd_offset_update(weights, mask, ec.atomics[(int)(*i)[0]].begin, ec.atomics[(int)(*i)[0]].end, k, update*r_dot_x, regularization);
+		  l_update[k] = update * x_dot_r[k];
+		  r_update[k] = update * x_dot_l[k];
 		}
 
-	      // update r^k weights
-	      for (size_t k = 1; k <= all.rank; k++)
-		{
-		  // l^k \cdot x_l
-		  float l_dot_x = ec.topic_predictions[2*k-1];
-		  // r^k <- r^k + update * (l^k \cdot x_l) * x_r
-		  sd_offset_update(weights, mask, ec.atomics[(int)(*i)[1]].begin, ec.atomics[(int)(*i)[1]].end, k+all.rank, update*l_dot_x, regularization);
-		}
+	      // l^k <- l^k + update * (r^k \cdot x_r) * x_l
+	      sd_offset_rank_update(weights, mask, ec.atomics[(int)(*i)[0]].begin, ec.atomics[(int)(*i)[0]].end, 1, 1, all.rank, l_update, regularization);
+	      // r^k <- r^k + update * (l^k \cdot x_l) * x_r
+	      sd_offset_rank_update(weights, mask, ec.atomics[(int)(*i)[1]].begin, ec.atomics[(int)(*i)[1]].end, 1+all.rank, 1, all.rank, r_update, regularization);
 
+	      first += 2*all.rank;
 	    }
 	}
+      ec.topic_predictions.end = ec.topic_predictions.begin + scaled;
+
   if (all.triples.begin() != all.triples.end()) {
     cerr << "cannot use triples in matrix factorization" << endl;
     throw exception();
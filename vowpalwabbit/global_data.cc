@@ -229,6 +229,7 @@ vw::vw()
   current_pass = 0;
 
   bfgs = false;
+  profile = NULL;
   hessian_on = false;
   reg.stride = 1;
   num_bits = 18;
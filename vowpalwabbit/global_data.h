@@ -163,6 +163,8 @@ struct vw {
   bool searn;
   void* /*Searn::searn*/ searnstr;
 
+  void* /*PROFILE::profile*/ profile; //NULL unless --profile
+
   uint32_t wpp; //debug: what is this?
 
   int stdout_fileno;
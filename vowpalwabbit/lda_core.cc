@@ -5,11 +5,19 @@ license as described in the file LICENSE.
  */
 #include <fstream>
 #include <vector>
+#include <algorithm>
 #include <float.h>
 #ifdef _WIN32
 #include <winsock2.h>
+#include <Windows.h>
 #else
 #include <netdb.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 #include <string.h>
 #include <stdio.h>
@@ -22,6 +30,7 @@ license as described in the file LICENSE.
 #include "cache.h"
 #include "simple_label.h"
 #include "rand48.h"
+#include "accumulate.h"
 #include "vw.h"
 
 using namespace LEARNER;
@@ -36,16 +45,58 @@ public:
   bool operator<(const index_feature b) const { return f.weight_index < b.f.weight_index; }
 };
 
-  struct lda {
+// orders features by the weight slot they use, so that words whose
+// hashes collide in the regressor end up next to each other
+struct slot_order {
+  size_t mask;
+  slot_order(size_t m) : mask(m) {}
+  bool operator()(const index_feature& a, const index_feature& b) const {
+    size_t sa = a.f.weight_index & mask, sb = b.f.weight_index & mask;
+    return sa < sb || (sa == sb && a.f.weight_index < b.f.weight_index);
+  }
+};
+
+  struct lda;
+
+  // scratch of one thread.  documents are dealt out round robin for the
+  // E-step; the words of the minibatch are split into ranges of whole
+  // weight slots, so the M-step of different threads never writes the
+  // same weights.
+  struct lda_worker {
+    lda* l;
+    size_t id;
+    size_t first_feature, last_feature; // [first, last) of sorted_features
+    void (*phase)(lda_worker&);
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+    v_array<float> new_gamma;
+    v_array<float> old_gamma;
     v_array<float> Elogtheta;
-    v_array<float> decay_levels;
     v_array<float> total_new;
+    v_array<float> total_init; // initial counts of rows first used in this minibatch, less their expectation
+    v_array<float> word_rows;  // inference: exp(E[log beta]) of the document's words
+    v_array<float> word_counts;
+    v_array<const float*> word_row_ptrs;
+  };
+
+  struct lda {
+    v_array<float> decay_levels;
     v_array<example* > examples;
     v_array<float> total_lambda;
     v_array<int> doc_lengths;
     v_array<float> digammas;
     v_array<float> v;
+    v_array<float> scores;
+    v_array<unsigned char> touched; // per row: initialized, i.e. used or read from the model
     vector<index_feature> sorted_features;
+    v_array<lda_worker*> workers;
+    float eta;
+    float minuseta;
+    char* topics_file;          // --lda_topics
+    float initial_decay;        // decay of the initial counts in the runs that wrote the model
 
     bool total_lambda_init;
     
@@ -239,9 +290,8 @@ vfastdigamma (v4sf x)
 }
 
 void
-vexpdigammify (vw& all, float* gamma)
+vexpdigammify (size_t n, float* gamma)
 {
-  unsigned int n = all.lda;
   float extra_sum = 0.0f;
   v4sf sum = v4sfl (0.0f);
   size_t i;
@@ -291,6 +341,11 @@ vexpdigammify (vw& all, float* gamma)
     } 
 }
 
+inline void vexpdigammify (vw& all, float* gamma)
+{
+  vexpdigammify (all.lda, gamma);
+}
+
 void vexpdigammify_2(vw& all, float* gamma, const float* norm)
 {
   size_t n = all.lda;
@@ -318,8 +373,40 @@ void vexpdigammify_2(vw& all, float* gamma, const float* norm)
     }
 }
 
+// topic rows start at arbitrary offsets into the regressor, so these
+// use unaligned loads
+inline float vdot(size_t n, const float* a, const float* b)
+{
+  size_t i;
+  v4sf sum = v4sfl (0.0f);
+
+  for (i = 0; i + 4 <= n; i += 4)
+    sum += _mm_loadu_ps (a + i) * _mm_loadu_ps (b + i);
+
+  float extra_sum = v4sf_index (sum, 0) + v4sf_index (sum, 1) +
+                    v4sf_index (sum, 2) + v4sf_index (sum, 3);
+  for (; i < n; ++i)
+    extra_sum += a[i] * b[i];
+  return extra_sum;
+}
+
+// y += a * x
+inline void vaxpy(size_t n, float a, const float* x, float* y)
+{
+  size_t i;
+  v4sf va = v4sfl (a);
+
+  for (i = 0; i + 4 <= n; i += 4)
+    _mm_storeu_ps (y + i, _mm_loadu_ps (y + i) + va * _mm_loadu_ps (x + i));
+
+  for (; i < n; ++i)
+    y[i] += a * x[i];
+}
+
 #define myexpdigammify vexpdigammify
 #define myexpdigammify_2 vexpdigammify_2
+#define mydot vdot
+#define myaxpy vaxpy
 
 #else
 #ifndef _WIN32
@@ -327,6 +414,8 @@ void vexpdigammify_2(vw& all, float* gamma, const float* norm)
 #endif
 #define myexpdigammify expdigammify
 #define myexpdigammify_2 expdigammify_2
+#define mydot dot
+#define myaxpy axpy
 
 #endif // __SSE2__
 
@@ -343,6 +432,8 @@ using namespace boost::math::policies;
 #define mylgamma boost::math::lgamma
 #define myexpdigammify expdigammify
 #define myexpdigammify_2 expdigammify_2
+#define mydot dot
+#define myaxpy axpy
 
 #endif // MINEIRO_SPECIAL
 
@@ -378,19 +469,24 @@ float decayfunc4(double t, double old_t, double power_t)
     return (float)decayfunc2((float)t, (float)old_t, (float)power_t);
 }
 
-void expdigammify(vw& all, float* gamma)
+void expdigammify(size_t n, float* gamma)
 {
   float sum=0;
-  for (size_t i = 0; i<all.lda; i++)
+  for (size_t i = 0; i<n; i++)
     {
       sum += gamma[i];
       gamma[i] = mydigamma(gamma[i]);
     }
   sum = mydigamma(sum);
-  for (size_t i = 0; i<all.lda; i++)
+  for (size_t i = 0; i<n; i++)
     gamma[i] = fmax(1e-6f, exp(gamma[i] - sum));
 }
 
+void expdigammify(vw& all, float* gamma)
+{
+  expdigammify(all.lda, gamma);
+}
+
 void expdigammify_2(vw& all, float* gamma, float* norm)
 {
   for (size_t i = 0; i<all.lda; i++)
@@ -399,17 +495,36 @@ void expdigammify_2(vw& all, float* gamma, float* norm)
     }
 }
 
-float average_diff(vw& all, float* oldgamma, float* newgamma)
+float dot(size_t n, const float* a, const float* b)
+{
+  float sum = 0;
+  for (size_t k = 0; k < n; k++)
+    sum += a[k]*b[k];
+  return sum;
+}
+
+void axpy(size_t n, float a, const float* x, float* y)
+{
+  for (size_t k = 0; k < n; k++)
+    y[k] += a*x[k];
+}
+
+float average_diff(size_t n, float* oldgamma, float* newgamma)
 {
   float sum = 0.;
   float normalizer = 0.;
-  for (size_t i = 0; i<all.lda; i++) {
+  for (size_t i = 0; i<n; i++) {
     sum += fabsf(oldgamma[i] - newgamma[i]);
     normalizer += newgamma[i];
   }
   return sum / normalizer;
 }
 
+float average_diff(vw& all, float* oldgamma, float* newgamma)
+{
+  return average_diff(all.lda, oldgamma, newgamma);
+}
+
 // Returns E_q[log p(\theta)] - E_q[log q(\theta)].
   float theta_kl(vw& all, v_array<float>& Elogtheta, float* gamma)
 {
@@ -434,22 +549,18 @@ float average_diff(vw& all, float* oldgamma, float* newgamma)
 
 float find_cw(vw& all, float* u_for_w, float* v)
 {
-  float c_w = 0;
-  for (size_t k =0; k<all.lda; k++)
-    c_w += u_for_w[k]*v[k];
-
-  return 1.f / c_w;
+  return 1.f / mydot(all.lda, u_for_w, v);
 }
 
-v_array<float> new_gamma;
-v_array<float> old_gamma;
 // Returns an estimate of the part of the variational bound that
 // doesn't have to do with beta for the entire corpus for the current
 // setting of lambda based on the document passed in. The value is
 // divided by the total number of words in the document This can be
 // used as a (possibly very noisy) estimate of held-out likelihood.
-  float lda_loop(vw& all, v_array<float>& Elogtheta, float* v,weight* weights,example* ec, float power_t)
+  float lda_loop(vw& all, lda_worker& w, float* v,weight* weights,example* ec)
 {
+  v_array<float>& new_gamma = w.new_gamma;
+  v_array<float>& old_gamma = w.old_gamma;
   new_gamma.erase();
   old_gamma.erase();
   
@@ -485,10 +596,7 @@ v_array<float> old_gamma;
 	      float c_w = find_cw(all, u_for_w,v);
 	      xc_w = c_w * f->x;
               score += -f->x*log(c_w);
-	      size_t max_k = all.lda;
-	      for (size_t k =0; k<max_k; k++) {
-		new_gamma[k] += xc_w*u_for_w[k];
-	      }
+	      myaxpy(all.lda, xc_w, u_for_w, new_gamma.begin);
 	      word_count++;
               doc_length += f->x;
 	    }
@@ -502,11 +610,244 @@ v_array<float> old_gamma;
   ec->topic_predictions.resize(all.lda);
   memcpy(ec->topic_predictions.begin,new_gamma.begin,all.lda*sizeof(float));
 
-  score += theta_kl(all, Elogtheta, new_gamma.begin);
+  score += theta_kl(all, w.Elogtheta, new_gamma.begin);
 
   return score / doc_length;
 }
 
+// The variational E-step for a document whose n words have the
+// exp(E[log beta]) rows rows[i] and counts x[i], without touching any
+// shared state.  scratch holds 2*K floats.  Returns the number of
+// iterations; word_score gets sum -x log c_w of the last one.
+size_t infer_gamma(size_t K, float alpha, float epsilon, const float* const* rows, const float* x, size_t n,
+		   float* gamma, float* scratch, float* word_score)
+{
+  float* v = scratch;
+  float* old_gamma = scratch + K;
+  for (size_t k = 0; k < K; k++)
+    gamma[k] = 1.f;
+
+  size_t iterations = 0;
+  float score = 0;
+  do
+    {
+      memcpy(v, gamma, sizeof(float)*K);
+      myexpdigammify(K, v);
+      memcpy(old_gamma, gamma, sizeof(float)*K);
+      memset(gamma, 0, sizeof(float)*K);
+
+      score = 0;
+      for (size_t i = 0; i < n; i++)
+	{
+	  float c_w = 1.f / mydot(K, rows[i], v);
+	  score += -x[i]*log(c_w);
+	  myaxpy(K, c_w * x[i], rows[i], gamma);
+	}
+      for (size_t k = 0; k < K; k++)
+	gamma[k] = gamma[k]*v[k] + alpha;
+      iterations++;
+    }
+  while (average_diff(K, old_gamma, gamma) > epsilon);
+
+  if (word_score != NULL)
+    *word_score = score;
+  return iterations;
+}
+
+// --lda_topics file: the header, the ids of the rows in increasing
+// order, then exp(E[log beta]) of each row
+struct topics_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t topics;
+  uint32_t num_bits;
+  uint32_t stride;
+  uint32_t rows;
+  float alpha;
+  float epsilon;
+  uint32_t reserved;
+};
+
+const char topics_magic[8] = { 'v', 'w', 'l', 'd', 'a', 't', 'o', 'p' };
+
+struct topics {
+  topics_header header;
+  const uint32_t* row_ids;
+  const float* rows;
+  void* data;
+  size_t data_len;
+};
+
+topics* open_topics(const char* filename)
+{
+  void* data = NULL;
+  size_t len = 0;
+#ifdef _WIN32
+  FILE* f = fopen(filename, "rb");
+  if (f != NULL) {
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(len);
+    if (fread(data, 1, len, f) != len) {
+      free(data);
+      data = NULL;
+    }
+    fclose(f);
+  }
+#else
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0) {
+    len = st.st_size;
+    data = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+      data = NULL;
+  }
+  if (fd >= 0)
+    close(fd);
+#endif
+  if (data == NULL) {
+    cerr << "can't read lda topics from " << filename << endl;
+    throw exception();
+  }
+
+  topics* t = (topics*)calloc(1, sizeof(topics));
+  t->data = data;
+  t->data_len = len;
+  if (len >= sizeof(topics_header))
+    memcpy(&t->header, data, sizeof(topics_header));
+  topics_header& h = t->header;
+  if (len < sizeof(topics_header) || memcmp(h.magic, topics_magic, sizeof(topics_magic)) != 0 || h.version != 1
+      || len != sizeof(topics_header) + (size_t)h.rows * sizeof(uint32_t) * (1 + h.topics)) {
+    cerr << filename << " is not an lda topics file" << endl;
+    close_topics(t);
+    throw exception();
+  }
+  t->row_ids = (const uint32_t*)((char*)data + sizeof(topics_header));
+  t->rows = (const float*)(t->row_ids + h.rows);
+  return t;
+}
+
+void close_topics(topics* t)
+{
+#ifdef _WIN32
+  free(t->data);
+#else
+  munmap(t->data, t->data_len);
+#endif
+  free(t);
+}
+
+size_t num_topics(const topics& t)
+{
+  return t.header.topics;
+}
+
+double now_us()
+{
+#ifdef _WIN32
+  LARGE_INTEGER frequency, count;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&count);
+  return count.QuadPart * 1e6 / frequency.QuadPart;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e6 + tv.tv_usec;
+#endif
+}
+
+size_t infer(const topics& t, const feature* begin, const feature* end, float* gamma, infer_buffers& b, infer_stats* stats)
+{
+  double start = stats != NULL ? now_us() : 0.;
+  const topics_header& h = t.header;
+  size_t K = h.topics;
+  uint32_t row_mask = (1 << h.num_bits) - 1;
+
+  vector<const float*>& rows = b.rows;
+  vector<float>& x = b.x;
+  rows.clear();
+  x.clear();
+  for (const feature* f = begin; f != end; f++)
+    {
+      uint32_t row = (f->weight_index / h.stride) & row_mask;
+      const uint32_t* id = lower_bound(t.row_ids, t.row_ids + h.rows, row);
+      if (id == t.row_ids + h.rows || *id != row)
+	continue;
+      rows.push_back(t.rows + (id - t.row_ids) * K);
+      x.push_back(f->x);
+    }
+
+  b.scratch.resize(2*K);
+  size_t iterations = infer_gamma(K, h.alpha, h.epsilon, rows.size() > 0 ? &rows[0] : NULL,
+				  x.size() > 0 ? &x[0] : NULL, rows.size(), gamma, &b.scratch[0], NULL);
+
+  if (stats != NULL)
+    {
+      double us = now_us() - start;
+      stats->calls++;
+      stats->iterations += iterations;
+      stats->words += rows.size();
+      stats->total_us += us;
+      if (us > stats->max_us)
+	stats->max_us = us;
+      size_t bucket = 0;
+      while (bucket + 1 < sizeof(stats->histogram)/sizeof(stats->histogram[0]) && us >= (double)((uint64_t)2 << bucket))
+	bucket++;
+      stats->histogram[bucket]++;
+    }
+  return rows.size();
+}
+
+size_t infer(const topics& t, example& ec, float* gamma, infer_buffers& b, infer_stats* stats)
+{
+  vector<feature>& features = b.features;
+  features.clear();
+  for (unsigned char* i = ec.indices.begin; i != ec.indices.end; i++)
+    features.insert(features.end(), ec.atomics[*i].begin, ec.atomics[*i].end);
+  const feature* begin = features.size() > 0 ? &features[0] : NULL;
+  return infer(t, begin, begin + features.size(), gamma, b, stats);
+}
+
+void merge_stats(infer_stats& into, const infer_stats& from)
+{
+  into.calls += from.calls;
+  into.iterations += from.iterations;
+  into.words += from.words;
+  into.total_us += from.total_us;
+  if (from.max_us > into.max_us)
+    into.max_us = from.max_us;
+  for (size_t b = 0; b < sizeof(into.histogram)/sizeof(into.histogram[0]); b++)
+    into.histogram[b] += from.histogram[b];
+}
+
+double latency_quantile(const infer_stats& s, double q)
+{
+  uint64_t seen = 0;
+  size_t buckets = sizeof(s.histogram)/sizeof(s.histogram[0]);
+  for (size_t b = 0; b < buckets; b++)
+    {
+      seen += s.histogram[b];
+      if (seen > 0 && seen >= q * s.calls)
+	return min((double)((uint64_t)2 << b), s.max_us);
+    }
+  return s.max_us;
+}
+
+void print_stats(ostream& out, const infer_stats& s)
+{
+  double calls = s.calls > 0 ? (double)s.calls : 1.;
+  out << "lda inference: " << s.calls << " documents, "
+      << s.words / calls << " known words and "
+      << s.iterations / calls << " iterations per document" << endl;
+  out << "latency (us): mean " << s.total_us / calls
+      << ", p50 <= " << latency_quantile(s, 0.5)
+      << ", p90 <= " << latency_quantile(s, 0.9)
+      << ", p99 <= " << latency_quantile(s, 0.99)
+      << ", max " << s.max_us << endl;
+}
+
 size_t next_pow2(size_t x) {
   int i = 0;
   x = x > 0 ? x - 1 : 0;
@@ -517,6 +858,32 @@ size_t next_pow2(size_t x) {
   return ((size_t)1) << i;
 }
 
+// the random topic counts a row starts with are 1 - log(u) for uniform
+// u, times this; their expectation is twice it.  A model that was read
+// back keeps the decay its rows have had since they were drawn.
+float init_scale(lda& l)
+{
+  vw& all = *l.all;
+  return (float)(all.lda_D / all.lda / all.length() * 200) * l.initial_decay;
+}
+
+// Topic rows are initialized when a word first uses them rather than all
+// 2^b of them up front.  The generator is seeded with the row, so a row
+// starts from the same counts whenever that happens.
+void init_row(lda& l, size_t row)
+{
+  vw& all = *l.all;
+  weight* weights_for_w = &all.reg.weight_vector[row*all.reg.stride];
+  if (all.random_weights) {
+    uint64_t seed = row;
+    float scale = init_scale(l);
+    for (size_t k = 0; k < all.lda; k++)
+      weights_for_w[k] = (float)(-log(merand48(seed)) + 1.0f) * scale;
+  }
+  weights_for_w[all.lda] = all.initial_t;
+  l.touched[row] = 1;
+}
+
 void save_load(lda& l, io_buf& model_file, bool read, bool text)
 {
   vw* all = l.all;
@@ -525,17 +892,12 @@ void save_load(lda& l, io_buf& model_file, bool read, bool text)
   
   if (read)
     {
+      // initialize_regressor would write the first weight of every row
+      bool random_weights = all->random_weights;
+      all->random_weights = false;
       initialize_regressor(*all);
-      for (size_t j = 0; j < stride*length; j+=stride)
-	{
-	  for (size_t k = 0; k < all->lda; k++) {
-	    if (all->random_weights) {
-	      all->reg.weight_vector[j+k] = (float)(-log(frand48()) + 1.0f);
-	      all->reg.weight_vector[j+k] *= (float)(all->lda_D / all->lda / all->length() * 200);
-	    }
-	  }
-	  all->reg.weight_vector[j+all->lda] = all->initial_t;
-	}
+      all->random_weights = random_weights;
+      l.touched.resize(length, true);
     }
     
   if (model_file.files.size() > 0)
@@ -544,22 +906,48 @@ void save_load(lda& l, io_buf& model_file, bool read, bool text)
       uint32_t text_len;
       char buff[512];
       size_t brw = 1;
+      vector<float> decay_row;
       do 
 	{
 	  brw = 0;
 	  size_t K = all->lda;
+
+	  // rows that were never used are not written; they start over
+	  // from their initial counts when the model is read back.  Row
+	  // "length" ends the file with how far those counts have decayed;
+	  // older models have no such row and start undecayed.
+	  if (!read) {
+	    while (i < length && !l.touched[i])
+	      i++;
+	    if (i == length) {
+	      decay_row.resize(K);
+	      for (size_t k = 0; k < K; k++)
+		decay_row[k] = l.initial_decay * exp(l.decay_levels.last());
+	    }
+	  }
 	  
 	  text_len = sprintf(buff, "%d ", i);
 	  brw += bin_text_read_write_fixed(model_file,(char *)&i, sizeof (i),
 					   "", read,
 					   buff, text_len, text);
+	  if (brw != 0 && read) {
+	    if (i > length)
+	      {
+		cerr << "lda model row " << i << " is out of range for " << length << " rows" << endl;
+		throw exception();
+	      }
+	    if (i == length)
+	      decay_row.resize(K);
+	    else {
+	      all->reg.weight_vector[stride*i+K] = all->initial_t;
+	      l.touched[i] = 1;
+	    }
+	  }
 	  if (brw != 0)
 	    for (uint32_t k = 0; k < K; k++)
 	      {
-		uint32_t ndx = stride*i+k;
-		
-		weight* v = &(all->reg.weight_vector[ndx]);
-		text_len = sprintf(buff, "%f ", *v + all->lda_rho);
+		weight* v = i < length ? &(all->reg.weight_vector[stride*i+k]) : &decay_row[k];
+		text_len = sprintf(buff, "%f ", i < length ? *v + all->lda_rho : *v);
 		
 		brw += bin_text_read_write_fixed(model_file,(char *)v, sizeof (*v),
 						 "", read,
@@ -571,70 +959,46 @@ void save_load(lda& l, io_buf& model_file, bool read, bool text)
 					     "", read,
 					     "\n",1,text);
 	  
+	  if (read && i >= length && brw != 0)
+	    l.initial_decay = decay_row[0];
 	  if (!read)
 	    i++;
 	}  
-      while ((!read && i < length) || (read && brw >0));
+      while ((!read && i <= length) || (read && brw >0));
     }
 }
 
-  void learn_batch(lda& l)
+  // refreshes the decayed topic counts of every word of the worker's
+  // range and the exp(E[log beta]) that the E-step reads
+  void prepare_words(lda_worker& w)
   {
-    if (l.sorted_features.empty()) {
-      // This can happen when the socket connection is dropped by the client.
-      // If l.sorted_features is empty, then l.sorted_features[0] does not
-      // exist, so we should not try to take its address in the beginning of
-      // the for loops down there. Since it seems that there's not much to
-      // do in this case, we just return.
-      return;
-    }
-
-    float eta = -1;
-    float minuseta = -1;
-
-    if (l.total_lambda.size() == 0)
-      {
-	for (size_t k = 0; k < l.all->lda; k++)
-	  l.total_lambda.push_back(0.f);
-	
-	size_t stride = l.all->reg.stride;
-	for (size_t i =0; i <= l.all->reg.weight_mask;i+=stride)
-	  for (size_t k = 0; k < l.all->lda; k++)
-	    l.total_lambda[k] += l.all->reg.weight_vector[i+k];
-      }
+    lda& l = *w.l;
+    weight* weights = l.all->reg.weight_vector;
+    float expected = l.all->random_weights ? 2.f * init_scale(l) : 0.f;
 
-    l.example_t++;
-    l.total_new.erase();
+    w.total_init.erase();
     for (size_t k = 0; k < l.all->lda; k++)
-      l.total_new.push_back(0.f);
-    
-    size_t batch_size = l.examples.size();
-   
-    sort(l.sorted_features.begin(), l.sorted_features.end());
-    
-    eta = l.all->eta * powf((float)l.example_t, - l.all->power_t);
-    minuseta = 1.0f - eta;
-    eta *= l.all->lda_D / batch_size;
-    l.decay_levels.push_back(l.decay_levels.last() + log(minuseta));
-    
-    l.digammas.erase();
-    float additional = (float)(l.all->length()) * l.all->lda_rho;
-    for (size_t i = 0; i<l.all->lda; i++) {
-      l.digammas.push_back(mydigamma(l.total_lambda[i] + additional));
-    }
-    
-    
-    weight* weights = l.all->reg.weight_vector;
-    
+      w.total_init.push_back(0.f);
+
     size_t last_weight_index = -1;
-    for (index_feature* s = &l.sorted_features[0]; s <= &l.sorted_features.back(); s++)
+    for (size_t i = w.first_feature; i < w.last_feature; i++)
       {
+	index_feature* s = &l.sorted_features[i];
 	if (last_weight_index == s->f.weight_index)
 	  continue;
 	last_weight_index = s->f.weight_index;
+	size_t row = (s->f.weight_index & l.all->reg.weight_mask) / l.all->reg.stride;
+	bool fresh = !l.touched[row];
+	if (fresh)
+	  init_row(l, row);
 	float* weights_for_w = &(weights[s->f.weight_index & l.all->reg.weight_mask]);
 	float decay = fmin(1.0, exp(l.decay_levels.end[-2] - l.decay_levels.end[(int)(-1 - l.example_t+weights_for_w[l.all->lda])]));
 	float* u_for_w = weights_for_w + l.all->lda+1;
+
+	// total_lambda counted this row at its expected initial counts
+	if (fresh)
+	  for (size_t k = 0; k < l.all->lda; k++)
+	    w.total_init[k] += (weights_for_w[k] - expected) * decay;
 	
 	weights_for_w[l.all->lda] = (float)l.example_t;
 	for (size_t k = 0; k < l.all->lda; k++)
@@ -644,24 +1008,34 @@ void save_load(lda& l, io_buf& model_file, bool read, bool text)
 	  }
 	myexpdigammify_2(*l.all, u_for_w, l.digammas.begin);
       }
-    
-    for (size_t d = 0; d < batch_size; d++)
-      {
-	float score = lda_loop(*l.all, l.Elogtheta, &(l.v[d*l.all->lda]), weights, l.examples[d],l.all->power_t);
-	if (l.all->audit)
-	  GD::print_audit_features(*l.all, *l.examples[d]);
-	// If the doc is empty, give it loss of 0.
-	if (l.doc_lengths[d] > 0) {
-	  l.all->sd->sum_loss -= score;
-	  l.all->sd->sum_loss_since_last_dump -= score;
-	}
-	return_simple_example(*l.all, NULL, *l.examples[d]);
-      }
-    
-    for (index_feature* s = &l.sorted_features[0]; s <= &l.sorted_features.back();)
+  }
+
+  // the variational E-step of the worker's documents
+  void infer_documents(lda_worker& w)
+  {
+    lda& l = *w.l;
+    weight* weights = l.all->reg.weight_vector;
+    for (size_t d = w.id; d < l.examples.size(); d += l.workers.size())
+      l.scores[d] = lda_loop(*l.all, w, &(l.v[d*l.all->lda]), weights, l.examples[d]);
+  }
+
+  // the M-step for the words of the worker's range
+  void update_words(lda_worker& w)
+  {
+    lda& l = *w.l;
+    weight* weights = l.all->reg.weight_vector;
+    float eta = l.eta;
+    float minuseta = l.minuseta;
+
+    w.total_new.erase();
+    for (size_t k = 0; k < l.all->lda; k++)
+      w.total_new.push_back(0.f);
+
+    index_feature* end = &l.sorted_features[0] + w.last_feature;
+    for (index_feature* s = &l.sorted_features[0] + w.first_feature; s != end;)
       {
 	index_feature* next = s+1;
-	while(next <= &l.sorted_features.back() && next->f.weight_index == s->f.weight_index)
+	while(next != end && next->f.weight_index == s->f.weight_index)
 	  next++;
 	
 	float* word_weights = &(weights[s->f.weight_index & l.all->reg.weight_mask]);
@@ -676,14 +1050,153 @@ void save_load(lda& l, io_buf& model_file, bool read, bool text)
 	  float c_w = eta*find_cw(*l.all, u_for_w, v_s)*s->f.x;
 	  for (size_t k = 0; k < l.all->lda; k++) {
 	    float new_value = u_for_w[k]*v_s[k]*c_w;
-	    l.total_new[k] += new_value;
+	    w.total_new[k] += new_value;
 	    word_weights[k] += new_value;
 	  }
 	}
       }
+  }
+
+#ifdef _WIN32
+  DWORD WINAPI run_worker(LPVOID in)
+#else
+  void* run_worker(void* in)
+#endif
+  {
+    lda_worker* w = (lda_worker*)in;
+    w->phase(*w);
+    return 0;
+  }
+
+  // runs phase on every worker, the first one on the calling thread
+  void run_phase(lda& l, void (*phase)(lda_worker&))
+  {
+    for (lda_worker** w = l.workers.begin; w != l.workers.end; w++)
+      (*w)->phase = phase;
+    for (lda_worker** w = l.workers.begin + 1; w < l.workers.end; w++)
+#ifdef _WIN32
+      (*w)->thread = ::CreateThread(NULL, 0, static_cast<LPTHREAD_START_ROUTINE>(run_worker), *w, NULL, NULL);
+#else
+      pthread_create(&(*w)->thread, NULL, run_worker, *w);
+#endif
+    phase(*l.workers[0]);
+    for (lda_worker** w = l.workers.begin + 1; w < l.workers.end; w++)
+      {
+#ifdef _WIN32
+	::WaitForSingleObject((*w)->thread, INFINITE);
+	::CloseHandle((*w)->thread);
+#else
+	pthread_join((*w)->thread, NULL);
+#endif
+      }
+  }
+
+  // splits the sorted features into one range per worker, cutting only
+  // between weight slots
+  void split_words(lda& l)
+  {
+    size_t n = l.sorted_features.size();
+    size_t workers = l.workers.size();
+    size_t mask = l.all->reg.weight_mask;
+    size_t first = 0;
+    for (size_t t = 0; t < workers; t++)
+      {
+	size_t last = max(first, (t+1)*n/workers);
+	while (last > 0 && last < n && (l.sorted_features[last].f.weight_index & mask) == (l.sorted_features[last-1].f.weight_index & mask))
+	  last++;
+	l.workers[t]->first_feature = first;
+	l.workers[t]->last_feature = last;
+	first = last;
+      }
+  }
+
+  void init_total_lambda(lda& l)
+  {
+    if (l.total_lambda.size() > 0)
+      return;
+
+    for (size_t k = 0; k < l.all->lda; k++)
+      l.total_lambda.push_back(0.f);
+
+    // rows not used yet are counted at their expected initial counts
+    size_t stride = l.all->reg.stride;
+    size_t fresh_rows = 0;
+    for (size_t i = 0; i < l.all->length(); i++) {
+      if (!l.touched[i]) {
+	fresh_rows++;
+	continue;
+      }
+      for (size_t k = 0; k < l.all->lda; k++)
+	l.total_lambda[k] += l.all->reg.weight_vector[i*stride+k];
+    }
+    float expected = l.all->random_weights ? 2.f * init_scale(l) : 0.f;
+    for (size_t k = 0; k < l.all->lda; k++)
+      l.total_lambda[k] += fresh_rows * expected;
+  }
+
+  void compute_digammas(lda& l)
+  {
+    l.digammas.erase();
+    float additional = (float)(l.all->length()) * l.all->lda_rho;
+    for (size_t i = 0; i<l.all->lda; i++) {
+      l.digammas.push_back(mydigamma(l.total_lambda[i] + additional));
+    }
+  }
+
+  void learn_batch(lda& l)
+  {
+    if (l.sorted_features.empty()) {
+      // This can happen when the socket connection is dropped by the client.
+      // If l.sorted_features is empty, then l.sorted_features[0] does not
+      // exist, so we should not try to take its address in the beginning of
+      // the for loops down there. Since it seems that there's not much to
+      // do in this case, we just return.
+      return;
+    }
+
+    init_total_lambda(l);
+
+    l.example_t++;
+    
+    size_t batch_size = l.examples.size();
+   
+    sort(l.sorted_features.begin(), l.sorted_features.end(), slot_order(l.all->reg.weight_mask));
+    split_words(l);
+    
+    l.eta = l.all->eta * powf((float)l.example_t, - l.all->power_t);
+    l.minuseta = 1.0f - l.eta;
+    l.eta *= l.all->lda_D / batch_size;
+    l.decay_levels.push_back(l.decay_levels.last() + log(l.minuseta));
+    
+    compute_digammas(l);
+    
+    run_phase(l, prepare_words);
+
+    l.scores.erase();
+    l.scores.resize(batch_size);
+    run_phase(l, infer_documents);
+    
+    for (size_t d = 0; d < batch_size; d++)
+      {
+	float score = l.scores[d];
+	if (l.all->audit)
+	  GD::print_audit_features(*l.all, *l.examples[d]);
+	// If the doc is empty, give it loss of 0.
+	if (l.doc_lengths[d] > 0) {
+	  l.all->sd->sum_loss -= score;
+	  l.all->sd->sum_loss_since_last_dump -= score;
+	}
+	return_simple_example(*l.all, NULL, *l.examples[d]);
+      }
+    
+    run_phase(l, update_words);
+
     for (size_t k = 0; k < l.all->lda; k++) {
-      l.total_lambda[k] *= minuseta;
-      l.total_lambda[k] += l.total_new[k];
+      for (lda_worker** w = l.workers.begin; w != l.workers.end; w++)
+	l.total_lambda[k] += (*w)->total_init[k];
+      l.total_lambda[k] *= l.minuseta;
+      for (lda_worker** w = l.workers.begin; w != l.workers.end; w++)
+	l.total_lambda[k] += (*w)->total_new[k];
     }
 
     l.sorted_features.resize(0);
@@ -692,8 +1205,71 @@ void save_load(lda& l, io_buf& model_file, bool read, bool text)
     l.doc_lengths.erase();
   }
   
+  // -t: the E-step of one document against the current topics, which are
+  // left as they are.  Words whose rows were never trained are skipped.
+  void infer_example(lda& l, example& ec)
+  {
+    vw& all = *l.all;
+    size_t K = all.lda;
+    size_t stride = all.reg.stride;
+    weight* weights = all.reg.weight_vector;
+    lda_worker& w = *l.workers[0];
+
+    if (l.digammas.size() == 0) {
+      init_total_lambda(l);
+      compute_digammas(l);
+    }
+
+    w.word_rows.erase();
+    w.word_counts.erase();
+    float doc_length = 0;
+    for (unsigned char* i = ec.indices.begin; i != ec.indices.end; i++)
+      for (feature* f = ec.atomics[*i].begin; f != ec.atomics[*i].end; f++)
+	{
+	  size_t row = (f->weight_index & all.reg.weight_mask) / stride;
+	  if (!l.touched[row])
+	    continue;
+	  float* weights_for_w = &weights[row*stride];
+	  float decay = fmin(1.0, exp(l.decay_levels.last() - l.decay_levels.end[(int)(-1 - l.example_t + weights_for_w[K])]));
+	  for (size_t k = 0; k < K; k++)
+	    w.word_rows.push_back(weights_for_w[k]*decay + all.lda_rho);
+	  myexpdigammify_2(all, w.word_rows.end - K, l.digammas.begin);
+	  w.word_counts.push_back(f->x);
+	  doc_length += f->x;
+	}
+
+    size_t n = w.word_counts.size();
+    w.word_row_ptrs.erase();
+    for (size_t i = 0; i < n; i++)
+      w.word_row_ptrs.push_back(w.word_rows.begin + i*K);
+    w.new_gamma.resize(K);
+    w.old_gamma.resize(2*K);
+
+    float score = 0;
+    infer_gamma(K, all.lda_alpha, all.lda_epsilon, w.word_row_ptrs.begin, w.word_counts.begin, n,
+		w.new_gamma.begin, w.old_gamma.begin, &score);
+
+    ec.topic_predictions.erase();
+    ec.topic_predictions.resize(K);
+    memcpy(ec.topic_predictions.begin, w.new_gamma.begin, K*sizeof(float));
+
+    if (all.audit)
+      GD::print_audit_features(all, ec);
+    if (doc_length > 0) {
+      score = (score + theta_kl(all, w.Elogtheta, w.new_gamma.begin)) / doc_length;
+      all.sd->sum_loss -= score;
+      all.sd->sum_loss_since_last_dump -= score;
+    }
+    return_simple_example(all, NULL, ec);
+  }
+
   void learn(lda& l, learner& base, example& ec) 
   {
+    if (!l.all->training) {
+      infer_example(l, ec);
+      return;
+    }
+
     size_t num_ex = l.examples.size();
     l.examples.push_back(&ec);
     l.doc_lengths.push_back(0);
@@ -718,20 +1294,139 @@ void save_load(lda& l, io_buf& model_file, bool read, bool text)
     ec.test_only = test_only;
   }
 
+  // Averages the topic counts of a cluster job over its nodes, as
+  // accumulate_avg does for GD.  Only rows that some node has used are
+  // exchanged: a node that has not used such a row yet contributes its
+  // initial counts.  Rows are brought to the current decay level first.
+  void accumulate_topics(lda& l)
+  {
+    vw& all = *l.all;
+    size_t length = all.length();
+    size_t stride = all.reg.stride;
+    size_t K = all.lda;
+    weight* weights = all.reg.weight_vector;
+    float expected = all.random_weights ? 2.f * init_scale(l) : 0.f;
+
+    init_total_lambda(l);
+
+    float* used = new float[length];
+    for (size_t i = 0; i < length; i++)
+      used[i] = l.touched[i];
+    all_reduce(used, (int)length, all.span_server, all.unique_id, all.total, all.node, all.socks);
+
+    size_t rows = 0;
+    for (size_t i = 0; i < length; i++)
+      if (used[i] > 0.f)
+	rows++;
+
+    float* counts = new float[(rows+1)*K];
+    size_t r = 0;
+    for (size_t i = 0; i < length; i++) {
+      if (used[i] == 0.f)
+	continue;
+      weight* weights_for_w = &weights[i*stride];
+      bool fresh = !l.touched[i];
+      if (fresh)
+	init_row(l, i);
+      float decay = fmin(1.0, exp(l.decay_levels.last() - l.decay_levels.end[(int)(-1 - l.example_t + weights_for_w[K])]));
+      for (size_t k = 0; k < K; k++) {
+	counts[r*K+k] = weights_for_w[k] * decay;
+	if (fresh)
+	  l.total_lambda[k] += (weights_for_w[k] - expected) * decay;
+      }
+      r++;
+    }
+    for (size_t k = 0; k < K; k++)
+      counts[rows*K+k] = l.total_lambda[k];
+
+    all_reduce(counts, (int)((rows+1)*K), all.span_server, all.unique_id, all.total, all.node, all.socks);
+
+    float nodes = (float)all.total;
+    r = 0;
+    for (size_t i = 0; i < length; i++) {
+      if (used[i] == 0.f)
+	continue;
+      weight* weights_for_w = &weights[i*stride];
+      for (size_t k = 0; k < K; k++)
+	weights_for_w[k] = counts[r*K+k] / nodes;
+      weights_for_w[K] = (float)l.example_t;
+      r++;
+    }
+    for (size_t k = 0; k < K; k++)
+      l.total_lambda[k] = counts[rows*K+k] / nodes;
+
+    delete[] used;
+    delete[] counts;
+  }
+
   void end_pass(lda& l)
   {
     if (l.examples.size())
       learn_batch(l);
+    if (l.all->span_server != "")
+      accumulate_topics(l);
   }
 
+// writes exp(E[log beta]) of every row that was used, for open_topics
+void write_topics(lda& l)
+{
+  vw& all = *l.all;
+  size_t K = all.lda;
+  size_t stride = all.reg.stride;
+
+  init_total_lambda(l);
+  compute_digammas(l);
+
+  topics_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, topics_magic, sizeof(topics_magic));
+  h.version = 1;
+  h.topics = (uint32_t)K;
+  h.num_bits = (uint32_t)all.num_bits;
+  h.stride = (uint32_t)stride;
+  h.alpha = all.lda_alpha;
+  h.epsilon = all.lda_epsilon;
+  for (size_t i = 0; i < all.length(); i++)
+    if (l.touched[i])
+      h.rows++;
+
+  FILE* f = fopen(l.topics_file, "wb");
+  if (f == NULL) {
+    cerr << "can't write lda topics to " << l.topics_file << endl;
+    throw exception();
+  }
+  fwrite(&h, sizeof(h), 1, f);
+  for (uint32_t i = 0; i < all.length(); i++)
+    if (l.touched[i])
+      fwrite(&i, sizeof(i), 1, f);
+
+  v_array<float> row;
+  row.resize(K);
+  for (size_t i = 0; i < all.length(); i++) {
+    if (!l.touched[i])
+      continue;
+    row.erase();
+    for (size_t k = 0; k < K; k++)
+      row.push_back(all.reg.weight_vector[i*stride+k] + all.lda_rho);
+    myexpdigammify_2(all, row.begin, l.digammas.begin);
+    fwrite(row.begin, sizeof(float), K, f);
+  }
+  row.delete_v();
+  fclose(f);
+}
+
 void end_examples(lda& l)
 {
   for (size_t i = 0; i < l.all->length(); i++) {
+    if (!l.touched[i])
+      continue;
     weight* weights_for_w = & (l.all->reg.weight_vector[i*l.all->reg.stride]);
     float decay = fmin(1.0, exp(l.decay_levels.last() - l.decay_levels.end[(int)(-1- l.example_t +weights_for_w[l.all->lda])]));
     for (size_t k = 0; k < l.all->lda; k++) 
       weights_for_w[k] *= decay;
   }
+  if (l.topics_file != NULL)
+    write_topics(l);
 }
 
   void finish_example(vw& all, lda&, example& ec)
@@ -740,14 +1435,27 @@ void end_examples(lda& l)
   void finish(lda& ld)
   {
     ld.sorted_features.~vector<index_feature>();
-    ld.Elogtheta.delete_v();
+    for (lda_worker** w = ld.workers.begin; w != ld.workers.end; w++) {
+      (*w)->new_gamma.delete_v();
+      (*w)->old_gamma.delete_v();
+      (*w)->Elogtheta.delete_v();
+      (*w)->total_new.delete_v();
+      (*w)->total_init.delete_v();
+      (*w)->word_rows.delete_v();
+      (*w)->word_counts.delete_v();
+      (*w)->word_row_ptrs.delete_v();
+      delete *w;
+    }
+    ld.workers.delete_v();
     ld.decay_levels.delete_v();
-    ld.total_new.delete_v();
     ld.examples.delete_v();
     ld.total_lambda.delete_v();
     ld.doc_lengths.delete_v();
     ld.digammas.delete_v();
     ld.v.delete_v();
+    ld.scores.delete_v();
+    ld.touched.delete_v();
+    free(ld.topics_file);
   }
 
 learner* setup(vw&all, vector<string>&opts, po::variables_map& vm)
@@ -764,7 +1472,9 @@ learner* setup(vw&all, vector<string>&opts, po::variables_map& vm)
     ("lda_rho", po::value<float>(&all.lda_rho), "Prior on sparsity of topic distributions")
     ("lda_D", po::value<float>(&all.lda_D), "Number of documents")
     ("lda_epsilon", po::value<float>(&all.lda_epsilon), "Loop convergence threshold")
-    ("minibatch", po::value<size_t>(&all.minibatch), "Minibatch size, for LDA");
+    ("minibatch", po::value<size_t>(&all.minibatch), "Minibatch size, for LDA")
+    ("lda_threads", po::value<size_t>(), "Number of threads for the E-step and M-step of a minibatch")
+    ("lda_topics", po::value<string>(), "Write the trained topics for LDA::open_topics at the end");
 
   po::parsed_options parsed = po::command_line_parser(opts).
     style(po::command_line_style::default_style ^ po::command_line_style::allow_guessing).
@@ -791,8 +1501,21 @@ learner* setup(vw&all, vector<string>&opts, po::variables_map& vm)
   }
   
   ld->v.resize(all.lda*all.minibatch);
+
+  if (vm.count("lda_topics"))
+    ld->topics_file = strdup(vm["lda_topics"].as<string>().c_str());
+
+  size_t threads = vm.count("lda_threads") ? vm["lda_threads"].as<size_t>() : 1;
+  threads = max(threads, (size_t)1);
+  for (size_t t = 0; t < threads; t++) {
+    lda_worker* w = new lda_worker();
+    w->l = ld;
+    w->id = t;
+    ld->workers.push_back(w);
+  }
   
   ld->decay_levels.push_back(0.f);
+  ld->initial_decay = 1.f;
 
   all.l->finish();
   learner* l = new learner(ld, all.reg.stride);
@@ -6,8 +6,52 @@ license as described in the file LICENSE.
 #ifndef LDA_CORE_H
 #define LDA_CORE_H
 
+#include <ostream>
+#include <vector>
+#include <stdint.h>
+#include "global_data.h"
+#include "example.h"
+#include "parse_args.h"
+
 namespace LDA{
   LEARNER::learner* setup(vw&, std::vector<std::string>&, po::variables_map&);
+
+  // Inference against the topics written by --lda_topics, outside of
+  // any vw instance.  The file is mapped read only, and all functions
+  // may be called concurrently on the same topics.
+  struct topics;
+  topics* open_topics(const char* filename);
+  void close_topics(topics*);
+  size_t num_topics(const topics&);
+
+  // Kept by the caller, e.g. one per thread, and combined with merge_stats.
+  struct infer_stats {
+    uint64_t calls;
+    uint64_t iterations;
+    uint64_t words;          // words found in the topics
+    double total_us;
+    double max_us;
+    uint64_t histogram[32];  // calls taking under 2^(b+1) us, and for b > 0 at least 2^b
+  };
+  void merge_stats(infer_stats& into, const infer_stats& from);
+  double latency_quantile(const infer_stats&, double q); // upper bound of the bucket
+  void print_stats(std::ostream&, const infer_stats&);
+
+  // Scratch space of infer, kept by the caller like infer_stats so that
+  // repeated calls reuse it rather than allocate.
+  struct infer_buffers {
+    std::vector<const float*> rows;
+    std::vector<float> x;
+    std::vector<float> scratch;
+    std::vector<feature> features;
+  };
+
+  // Writes the topic weights (gamma) of a document to gamma, which holds
+  // num_topics floats.  The features are hashed as by vw with the -b of
+  // the model and --lda; words the model has not seen are skipped.
+  // Returns the number of words used.  stats may be NULL.
+  size_t infer(const topics&, const feature* begin, const feature* end, float* gamma, infer_buffers&, infer_stats* stats);
+  size_t infer(const topics&, example& ec, float* gamma, infer_buffers&, infer_stats* stats);
 }
 
 #endif
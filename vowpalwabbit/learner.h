@@ -7,6 +7,7 @@ license as described in the file LICENSE.
 #define LEARNER_H
 // This is the interface for a learning algorithm
 #include<iostream>
+#include<typeinfo>
 using namespace std;
 
 struct vw;
@@ -37,6 +38,7 @@ namespace LEARNER
     void (*learn_f)(void* data, learner& base, example&);
     void (*predict_f)(void* data, learner& base, example&);
     void (*update_f)(void* data, learner& base, example&);
+    void (*multipredict_f)(void* data, learner& base, example&, size_t count, size_t step, float* pred);
   };
 
   struct save_load_data{
@@ -59,13 +61,17 @@ namespace LEARNER
   inline void generic_func(void* data) {}
 
   const save_load_data generic_save_load_fd = {NULL, NULL, generic_sl};
-  const learn_data generic_learn_fd = {NULL, NULL, generic_learner, NULL, NULL};
+  const learn_data generic_learn_fd = {NULL, NULL, generic_learner, NULL, NULL, NULL};
   const func_data generic_func_fd = {NULL, NULL, generic_func};
   
   template<class R, void (*T)(R&, learner& base, example& ec)>
     inline void tlearn(void* d, learner& base, example& ec)
     { T(*(R*)d, base, ec); }
 
+  template<class R, void (*T)(R&, learner& base, example& ec, size_t count, size_t step, float* pred)>
+    inline void tmultipredict(void* d, learner& base, example& ec, size_t count, size_t step, float* pred)
+    { T(*(R*)d, base, ec, count, step, pred); }
+
   template<class R, void (*T)(R&, io_buf& io, bool read, bool text)>
     inline void tsl(void* d, io_buf& io, bool read, bool text)
   { T(*(R*)d, io, read, text); }
@@ -101,6 +107,24 @@ private:
 public:
   size_t weights; //this stores the number of "weight vectors" required by the learner.
   size_t increment;
+  const char* name; //the type of the learner's state, for reports (see PROFILE)
+  bool reads_features; //reads features itself instead of through GD::foreach_feature, so it ignores ec.difference_offset (see WAP)
+
+  //the learner it reduces to, for code that walks the stack (see PROFILE)
+  inline learner* get_base() { return learn_fd.base; }
+
+  //sends every learn, predict, update and multipredict call through fd's
+  //functions with fd's data instead, and returns the learner's own for
+  //them to call on (see PROFILE)
+  inline learn_data wrap(learn_data fd)
+  {
+    learn_data own = learn_fd;
+    fd.base = learn_fd.base;
+    if (learn_fd.multipredict_f == NULL)
+      fd.multipredict_f = NULL;
+    learn_fd = fd;
+    return own;
+  }
 
   //called once for each example.  Must work under reduction.
   inline void learn(example& ec, size_t i=0) 
@@ -112,6 +136,7 @@ public:
   template <class T, void (*u)(T& data, learner& base, example&)>
   inline void set_learn()
   {
+    name = typeid(T).name();
     learn_fd.learn_f = tlearn<T,u>;
     learn_fd.update_f = tlearn<T,u>;
   }
@@ -128,6 +153,30 @@ public:
     learn_fd.predict_f = tlearn<T,u>;
   }
 
+  //final predictions of problems i .. i+count-1 into pred.  Learners
+  //that can share the pass over the features do; the rest predict them
+  //one at a time.
+  inline void multipredict(example& ec, size_t i, size_t count, float* pred)
+  {
+    if (learn_fd.multipredict_f == NULL)
+      {
+	for (size_t c = 0; c < count; c++)
+	  {
+	    predict(ec, i+c);
+	    pred[c] = ec.final_prediction;
+	  }
+	return;
+      }
+    ec.ft_offset += (uint32_t)(increment*i);
+    learn_fd.multipredict_f(learn_fd.data, *learn_fd.base, ec, count, increment, pred);
+    ec.ft_offset -= (uint32_t)(increment*i);
+  }
+  template <class T, void (*u)(T& data, learner& base, example&, size_t count, size_t step, float* pred)>
+  inline void set_multipredict()
+  {
+    learn_fd.multipredict_f = tmultipredict<T,u>;
+  }
+
   inline void update(example& ec, size_t i=0) 
   { 
     ec.ft_offset += (uint32_t)(increment*i);
@@ -192,6 +241,8 @@ public:
   {
     weights = 1;
     increment = 1;
+    name = NULL;
+    reads_features = true;
 
     learn_fd = LEARNER::generic_learn_fd;
     finish_example_fd.data = NULL;
@@ -222,6 +273,7 @@ public:
     
     learn_fd.data = dat;
     learn_fd.base = base;
+    learn_fd.multipredict_f = NULL; // the base's would skip this reduction
 
     finisher_fd.data = dat;
     finisher_fd.base = base;
@@ -12,6 +12,10 @@ namespace LRQ {
     size_t orig_size[256];
     std::vector<std::string> lrpairs;
     bool dropout;
+    bool factored;
+    v_array<float> sums;       // --lrqfactored: per pair and rank, the factor sums
+    double sum_norm_x[2];      // squared norms seen by the left and right factors
+    double total_weight[2];
     uint64_t seed;
     uint64_t initial_seed;
   };
@@ -177,6 +181,193 @@ namespace LRQ {
       }
   }
 
+  // sum over a namespace of the rank n factor weights times the feature values
+  float factor_sum(vw& all, example& ec, unsigned char ns, unsigned int n, bool perturb)
+  {
+    float sum = 0.f;
+    for (feature* f = ec.atomics[ns].begin; f != ec.atomics[ns].end; ++f)
+      {
+        uint32_t windex = (uint32_t)(f->weight_index + ec.ft_offset + n * all.reg.stride);
+        float* w = &all.reg.weight_vector[windex & all.reg.weight_mask];
+
+        // perturb away from saddle point at (0, 0)
+        if (perturb && *w == 0)
+          *w = cheesyrand (windex);
+
+        sum += *w * f->x;
+      }
+    return sum;
+  }
+
+  // the gradient of the low rank term with respect to a rank n factor weight
+  // of ns is other * x, where other is the opposite factor sum.  the first
+  // pass keeps gd's adaptive sums for features of that value, adds up their
+  // squares and returns their norm; the second takes the step and returns
+  // the change of the factor sum.  inv_norm stands in for --normalized:
+  // other moves with every update, so per feature ranges would mean little
+  // and only the average scale of the block is divided out
+  template <bool step>
+  float factor_pass(vw& all, example& ec, unsigned char ns, unsigned int n, float other, float g, float update, float inv_norm, float& norm_x)
+  {
+    float ret = 0.f;
+    for (feature* f = ec.atomics[ns].begin; f != ec.atomics[ns].end; ++f)
+      {
+        float* w = &all.reg.weight_vector[(f->weight_index + ec.ft_offset + n * all.reg.stride) & all.reg.weight_mask];
+        float x = other * f->x;
+        float x2 = x * x;
+
+        float t = inv_norm * inv_norm;
+        if (all.adaptive)
+          {
+            if (! step)
+              w[1] += g * x2;
+            t = inv_norm / sqrtf (w[1]);
+          }
+
+        if (step)
+          {
+            w[0] += update * x * t;
+            ret += update * x * t * f->x;
+          }
+        else
+          {
+            norm_x += x2;
+            ret += x2 * t;
+          }
+      }
+    return ret;
+  }
+
+  // one block coordinate step on the side (0 left, 1 right) factors of every
+  // pair, holding the other side fixed.  the term is linear in the block, so
+  // the loss' update applies to it as it does to plain features; prediction
+  // and the sums of side are moved to where the step leaves them
+  void factor_step(LRQstate& lrq, example& ec, size_t side, float& prediction)
+  {
+    vw& all = *lrq.all;
+    label_data* ld = (label_data*) ec.ld;
+    float g = all.loss->getSquareGrad(prediction, ld->label) * ld->weight;
+    if (g == 0.f)
+      return;
+
+    float norm = 0.f, norm_x = 0.f;
+    float* s = lrq.sums.begin;
+    for (vector<string>::iterator i = lrq.lrpairs.begin ();
+         i != lrq.lrpairs.end ();
+         ++i)
+      {
+        unsigned int k = atoi (i->c_str () + 2);
+        for (unsigned int n = 1; n <= k; ++n, s += 3)
+          if (s[1-side] != 0.f)
+            norm += factor_pass<false> (all, ec, (*i)[side], n, s[1-side], g, 0.f, 1.f, norm_x);
+      }
+    if (norm <= 0.f)
+      return;
+
+    float inv_norm = 1.f;
+    if (all.normalized_updates)
+      {
+        lrq.sum_norm_x[side] += ld->weight * norm_x;
+        lrq.total_weight[side] += ld->weight;
+        inv_norm = 1.f / sqrtf ((float)(lrq.sum_norm_x[side] / lrq.total_weight[side]));
+        norm *= all.adaptive ? inv_norm : inv_norm * inv_norm;
+      }
+
+    float eta_t = all.eta * norm * ld->weight;
+    if (! all.adaptive && all.power_t != 0)
+      eta_t *= powf ((float)(ec.example_t - all.sd->weighted_holdout_examples), -all.power_t);
+    float update = all.invariant_updates
+      ? all.loss->getUpdate(prediction, ld->label, eta_t, norm)
+      : all.loss->getUnsafeUpdate(prediction, ld->label, eta_t, norm);
+
+    s = lrq.sums.begin;
+    for (vector<string>::iterator i = lrq.lrpairs.begin ();
+         i != lrq.lrpairs.end ();
+         ++i)
+      {
+        unsigned int k = atoi (i->c_str () + 2);
+        for (unsigned int n = 1; n <= k; ++n, s += 3)
+          if (s[1-side] != 0.f)
+            {
+              float delta = factor_pass<true> (all, ec, (*i)[side], n, s[1-side], g, update, inv_norm, norm_x);
+              prediction += delta * s[1-side];
+              s[side] += delta * s[2];
+            }
+      }
+  }
+
+  // --lrqfactored: each pair contributes sum_n (sum_l lw_n x_l) (sum_r rw_n x_r),
+  // which takes one pass over each namespace per rank instead of adding
+  // |left| * |right| * k features to the example.  the term reaches the base
+  // learner through the label's initial value; after the base learner's step
+  // the factors take one step per side on what is left of the loss, as the
+  // unfactored path does with its two passes.
+  template <bool is_learn>
+  void factored_predict_or_learn(LRQstate& lrq, learner& base, example& ec)
+  {
+    vw& all = *lrq.all;
+    label_data* ld = (label_data*) ec.ld;
+
+    bool train = all.training && ! example_is_test (ec);
+    bool do_dropout = lrq.dropout && train;
+    float scale = (! lrq.dropout || do_dropout) ? 1.f : 0.5f;
+
+    // per pair and rank: keep * left sum, keep * right sum, keep
+    lrq.sums.erase ();
+    float term = 0.f;
+    for (vector<string>::iterator i = lrq.lrpairs.begin ();
+         i != lrq.lrpairs.end ();
+         ++i)
+      {
+        unsigned char left = (*i)[0];
+        unsigned char right = (*i)[1];
+        unsigned int k = atoi (i->c_str () + 2);
+
+        for (unsigned int n = 1; n <= k; ++n)
+          {
+            // dropout removes a whole rank component rather than single products
+            float keep = (! do_dropout || cheesyrbit (lrq.seed)) ? scale : 0.f;
+            float lsum = factor_sum (all, ec, left, n, train);
+            // as with the unfactored path's first pass, only one side starts
+            // off the saddle point so that the term starts out at zero
+            float rsum = factor_sum (all, ec, right, n, false);
+
+            lrq.sums.push_back (keep * lsum);
+            lrq.sums.push_back (keep * rsum);
+            lrq.sums.push_back (keep);
+            term += keep * lsum * rsum;
+          }
+      }
+
+    float initial = ld->initial;
+    ld->initial += term;
+    if (is_learn)
+      base.learn(ec);
+    else
+      base.predict(ec);
+
+    if (is_learn && train && ld->weight > 0 && ec.eta_round != 0.f)
+      {
+        float first_prediction = ec.final_prediction;
+        float first_loss = ec.loss;
+
+        base.predict(ec);
+        float prediction = ec.final_prediction;
+        factor_step (lrq, ec, 0, prediction);
+        factor_step (lrq, ec, 1, prediction);
+
+        ec.final_prediction = first_prediction;
+        ec.loss = first_loss;
+      }
+
+    ld->initial = initial;
+  }
+
+  void finish(LRQstate& lrq)
+  {
+    lrq.sums.delete_v();
+  }
+
   learner* setup(vw& all, std::vector<std::string>&opts, po::variables_map& vm, po::variables_map& vm_file)
   {//parse and set arguments
     LRQstate* lrq = (LRQstate*) calloc (1, sizeof (LRQstate));
@@ -193,6 +384,11 @@ namespace LRQ {
     if (lrq->dropout && !vm_file.count("lrqdropout"))
       all.options_from_file.append(" --lrqdropout");
 
+    lrq->factored = vm.count("lrqfactored") || vm_file.count("lrqfactored");
+
+    if (lrq->factored && !vm_file.count("lrqfactored"))
+      all.options_from_file.append(" --lrqfactored");
+
     if (!vm_file.count("lrq"))
       {
         lrq->lrpairs = vm["lrq"].as<vector<string> > ();
@@ -217,6 +413,8 @@ namespace LRQ {
         cerr << "creating low rank quadratic features for pairs: ";
         if (lrq->dropout)
           cerr << "(using dropout) ";
+        if (lrq->factored)
+          cerr << "(factored) ";
       }
 
     for (vector<string>::iterator i = lrq->lrpairs.begin (); 
@@ -245,9 +443,19 @@ namespace LRQ {
         
     all.wpp = all.wpp * (1 + maxk);
     learner* l = new learner(lrq, all.l, 1 + maxk);
-    l->set_learn<LRQstate, predict_or_learn<true> >();
-    l->set_predict<LRQstate, predict_or_learn<false> >();
+    l->reads_features = true;
+    if (lrq->factored)
+      {
+        l->set_learn<LRQstate, factored_predict_or_learn<true> >();
+        l->set_predict<LRQstate, factored_predict_or_learn<false> >();
+      }
+    else
+      {
+        l->set_learn<LRQstate, predict_or_learn<true> >();
+        l->set_predict<LRQstate, predict_or_learn<false> >();
+      }
     l->set_end_pass<LRQstate,reset_seed>();
+    l->set_finish<LRQstate,finish>();
 
     // TODO: leaks memory ?
     return l;
@@ -11,6 +11,7 @@
 #include "reductions.h"
 #include "simple_label.h"
 #include "gd.h"
+#include "sparse_dense.h"
 #include "rand48.h"
 
 using namespace std;
@@ -36,6 +37,12 @@ struct mf {
   // array for temp storage of features
   v_array<feature> temp_features;
 
+  // with a plain gd base learner the factors are read and updated here
+  // directly: [ w*(1,x_l,x_r), then per pair l^1*x_l, ..., l^rank*x_l, r^1*x_r, ..., r^rank*x_r ]
+  bool fused;
+  v_array<float> factor_sums;
+  v_array<float> factor_updates;
+
   vw* all;
 };
 
@@ -169,6 +176,90 @@ void learn(mf& data, learner& base, example& ec) {
   copy_array(ec.indices, data.indices);
 }
 
+// the factors k of a feature are increment apart starting k*increment past
+// its linear weight, so each namespace is swept once for all ranks rather
+// than once per rank through the base learner
+void fused_predict(mf& data, learner& base, example& ec) {
+  vw* all = data.all;
+  label_data* ld = (label_data*)ec.ld;
+  size_t increment = data.increment;
+
+  // predict from linear terms
+  base.predict(ec);
+  float prediction = ec.partial_prediction;
+
+  data.factor_sums.erase();
+  data.factor_sums.push_back(ec.partial_prediction);
+
+  for (vector<string>::iterator i = data.pairs.begin(); i != data.pairs.end(); i++) {
+
+    int left_ns = (int) (*i)[0];
+    int right_ns = (int) (*i)[1];
+
+    if (ec.atomics[left_ns].size() > 0 && ec.atomics[right_ns].size() > 0) {
+      size_t first = data.factor_sums.size();
+      // each sum starts from the label's initial value, as a base learner prediction does
+      for (size_t k = 0; k < 2*all->rank; k++)
+	data.factor_sums.push_back(ld->initial);
+      float* x_dot_l = data.factor_sums.begin + first;
+      float* x_dot_r = x_dot_l + all->rank;
+
+      sd_offset_rank_add(all->reg.weight_vector, all->reg.weight_mask, ec.atomics[left_ns].begin, ec.atomics[left_ns].end,
+			 ec.ft_offset + increment, increment, all->rank, x_dot_l);
+      sd_offset_rank_add(all->reg.weight_vector, all->reg.weight_mask, ec.atomics[right_ns].begin, ec.atomics[right_ns].end,
+			 ec.ft_offset + (all->rank+1)*increment, increment, all->rank, x_dot_r);
+
+      for (size_t k = 0; k < all->rank; k++)
+	prediction += x_dot_l[k] * x_dot_r[k];
+    }
+  }
+
+  ec.partial_prediction = prediction;
+  ec.final_prediction = GD::finalize_prediction(*(data.all), ec.partial_prediction);
+}
+
+void fused_learn(mf& data, learner& base, example& ec) {
+  vw* all = data.all;
+  size_t increment = data.increment;
+
+  fused_predict(data, base, ec);
+
+  // update linear weights; the base learner's step size is the one
+  // every factor update through it would have computed
+  base.update(ec);
+  float update = ec.eta_round;
+  if (update == 0.)
+    return;
+
+  data.factor_updates.resize(2*all->rank, true);
+  data.factor_updates.end = data.factor_updates.begin + 2*all->rank;
+  float* l_update = data.factor_updates.begin;
+  float* r_update = l_update + all->rank;
+
+  float* x_dot_l = data.factor_sums.begin + 1;
+  for (vector<string>::iterator i = data.pairs.begin(); i != data.pairs.end(); i++) {
+
+    int left_ns = (int) (*i)[0];
+    int right_ns = (int) (*i)[1];
+
+    if (ec.atomics[left_ns].size() > 0 && ec.atomics[right_ns].size() > 0) {
+      float* x_dot_r = x_dot_l + all->rank;
+      for (size_t k = 0; k < all->rank; k++) {
+	l_update[k] = update * x_dot_r[k];
+	r_update[k] = update * x_dot_l[k];
+      }
+
+      // l^k <- l^k + update * (r^k * x_r) * x_l, and likewise for r^k
+      sd_offset_rank_update(all->reg.weight_vector, all->reg.weight_mask, ec.atomics[left_ns].begin, ec.atomics[left_ns].end,
+			    ec.ft_offset + increment, increment, all->rank, l_update, 0.);
+      sd_offset_rank_update(all->reg.weight_vector, all->reg.weight_mask, ec.atomics[right_ns].begin, ec.atomics[right_ns].end,
+			    ec.ft_offset + (all->rank+1)*increment, increment, all->rank, r_update, 0.);
+
+      x_dot_l += 2*all->rank;
+    }
+  }
+}
+
 void finish(mf& o) {
   // restore global pairs
   o.all->pairs = o.pairs;
@@ -176,6 +267,9 @@ void finish(mf& o) {
   // clean up local v_arrays
   o.indices.delete_v();
   o.sub_predictions.delete_v();
+  o.temp_features.delete_v();
+  o.factor_sums.delete_v();
+  o.factor_updates.delete_v();
 }
 
 
@@ -191,15 +285,31 @@ learner* setup(vw& all, po::variables_map& vm) {
   data->pairs = all.pairs;
   all.pairs.clear();
 
-  // initialize weights randomly
+  // initialize weights randomly; the model is only read after setup, so
+  // the weights may not be allocated yet
   if(!vm.count("initial_regressor"))
     {
+      initialize_regressor(all);
       for (size_t j = 0; j < (all.reg.weight_mask + 1) / all.reg.stride; j++)
 	all.reg.weight_vector[j*all.reg.stride] = (float) (0.1 * frand48());
     }
+  // the fused path writes the factors as plain sgd would; anything that
+  // changes that step (regularization, masks, another base) goes through
+  // the base learner once per rank
+  data->fused = !vm.count("nn") && !vm.count("feature_mask") && !all.active
+    && all.reg_mode == 0 && !all.adaptive && !all.normalized_updates && all.triples.empty();
+
   learner* l = new learner(data, all.l, 2*data->rank+1);
-  l->set_learn<mf, learn>();
-  l->set_predict<mf, predict<false> >();
+  l->reads_features = true;
+  data->increment = (uint32_t)all.l->increment;
+  if (data->fused) {
+    l->set_learn<mf, fused_learn>();
+    l->set_predict<mf, fused_predict>();
+  }
+  else {
+    l->set_learn<mf, learn>();
+    l->set_predict<mf, predict<false> >();
+  }
   l->set_finish<mf,finish>();
   return l;
 }
@@ -21,6 +21,7 @@ namespace NN {
   const float hidden_min_activation = -3;
   const float hidden_max_activation = 3;
   const int nn_constant = 533357803;
+  const uint32_t deep_stride = 2; // a dense layer weight and its squared gradient sum
   
   struct nn {
     uint32_t k;
@@ -31,8 +32,30 @@ namespace NN {
     uint64_t xsubi;
     uint64_t save_xsubi;
     bool inpass;
+    bool dense;
     bool finished_setup;
 
+    // --nn_layers: dense layers between the hidden layer and the output
+    uint32_t depth;            // number of dense layers, the last one is the output
+    v_array<uint32_t> sizes;   // units per layer, sizes[0] = k and sizes[depth] = 1
+    v_array<size_t> offsets;   // first parameter of each dense layer, offsets[depth+1] is the total
+    v_array<uint32_t> initialized; // ft_offset / stride of each set of dense layers
+    v_array<weight> layers;        // their dense layer weights, in the same order
+    v_array<float> grad;
+    v_array<float> grad2;
+    v_array<float> squares;
+
+    // training minibatch
+    uint32_t batch;
+    uint32_t pending;
+    uint32_t batch_offset;       // ft_offset of the pending examples
+    v_array<size_t> act_offsets; // start of each layer's batch x units block in acts
+    v_array<float> acts;
+    v_array<float> deltas;
+    v_array<float> gradients;    // loss gradient of each pending prediction
+    v_array<feature> inputs;     // feature blocks and values of the pending examples
+    v_array<size_t> input_ends;
+
     vw* all;
   };
 
@@ -62,6 +85,116 @@ namespace NN {
     return -1.0f + 2.0f / (1.0f + fastexp (-2.0f * p));
   }
 
+  // fasttanh over a whole layer; kept branch free so it vectorizes
+  static inline void
+  fasttanh_layer (float* out, const float* in, uint32_t k)
+  {
+    for (uint32_t i = 0; i < k; ++i)
+      {
+        float p = in[i];
+        p = (p < hidden_min_activation) ? hidden_min_activation : p;
+        p = (p > hidden_max_activation) ? hidden_max_activation : p;
+        out[i] = fasttanh (p);
+      }
+  }
+
+  // --dense_hidden computes every hidden unit in a single sweep over the
+  // features.  Unit i of a feature sits i*stride past the feature's own
+  // weight, which is where base.predict(ec, i) finds linear features, so the
+  // k weights a feature feeds are adjacent.  With --inpass the passthrough
+  // term rides along as unit k.
+  struct dense_sweep {
+    float* h;
+    uint32_t units;
+    uint32_t stride;
+    weight* weights;
+    size_t mask;
+    float eta;
+    v_array<feature>* record; // where the feature blocks go for a later update
+  };
+
+  template <bool record>
+  inline void hidden_sweep(dense_sweep& d, const float x, float& w)
+  {
+    size_t b = &w - d.weights;
+    if (record)
+      {
+        feature f = {x, (uint32_t)b};
+        d.record->push_back(f);
+      }
+    if (b + (d.units - 1) * d.stride <= d.mask)
+      {
+        weight* u = &w;
+        if (d.stride == 1)
+          for (uint32_t i = 0; i < d.units; ++i)
+            d.h[i] += x * u[i];
+        else
+          for (uint32_t i = 0; i < d.units; ++i)
+            d.h[i] += x * u[i * d.stride];
+      }
+    else
+      for (uint32_t i = 0; i < d.units; ++i)
+        d.h[i] += x * d.weights[(b + i * d.stride) & d.mask];
+  }
+
+  template <bool adaptive>
+  inline void sgd_step(weight* w, float g, float eta)
+  {
+    if (adaptive)
+      {
+        w[1] += g * g;
+        if (w[1] > 0)
+          w[0] -= eta * g / sqrtf (w[1]);
+      }
+    else
+      w[0] -= eta * g;
+  }
+
+  // h holds the loss gradient of each unit
+  template <bool adaptive>
+  inline void update_block(dense_sweep& d, const float x, size_t b)
+  {
+    if (b + (d.units - 1) * d.stride <= d.mask)
+      {
+        weight* u = d.weights + b;
+        for (uint32_t i = 0; i < d.units; ++i)
+          sgd_step<adaptive> (u + i * d.stride, x * d.h[i], d.eta);
+      }
+    else
+      for (uint32_t i = 0; i < d.units; ++i)
+        sgd_step<adaptive> (&d.weights[(b + i * d.stride) & d.mask], x * d.h[i], d.eta);
+  }
+
+  template <bool adaptive>
+  inline void hidden_update(dense_sweep& d, const float x, float& w)
+  {
+    update_block<adaptive> (d, x, &w - d.weights);
+  }
+
+  // C += A B for row-major C (m x n), B (p x n) and A (m x p, or p x m when
+  // trans_a), tiled so the blocks being combined stay in cache
+  void gemm(bool trans_a, size_t m, size_t n, size_t p, const float* a, const float* b, float* c)
+  {
+    const size_t tile = 64;
+    for (size_t i0 = 0; i0 < m; i0 += tile)
+      for (size_t k0 = 0; k0 < p; k0 += tile)
+        for (size_t j0 = 0; j0 < n; j0 += tile)
+          {
+            size_t i1 = min (i0 + tile, m), k1 = min (k0 + tile, p), j1 = min (j0 + tile, n);
+            for (size_t i = i0; i < i1; ++i)
+              {
+                float* ci = c + i * n;
+                for (size_t k = k0; k < k1; ++k)
+                  {
+                    float aik = trans_a ? a[k * m + i] : a[i * p + k];
+                    const float* bk = b + k * n;
+                    for (size_t j = j0; j < j1; ++j)
+                      ci[j] += aik * bk[j];
+                  }
+              }
+          }
+  }
+
   void finish_setup (nn& n, vw& all)
   {
     // TODO: output_layer audit
@@ -88,8 +221,11 @@ namespace NN {
     n.finished_setup = true;
   }
 
+  void deep_flush(nn& n);
+
   void end_pass(nn& n)
   {
+    deep_flush (n);
     if (n.all->bfgs)
       n.xsubi = n.save_xsubi;
   }
@@ -289,6 +425,441 @@ CONVERSE: // That's right, I'm using goto.  So sue me.
     ec.loss = save_ec_loss;
   }
 
+  template <bool is_learn>
+  void dense_predict_or_learn(nn& n, learner& base, example& ec)
+  {
+    vw& all = *n.all;
+    bool shouldOutput = all.raw_prediction > 0;
+    label_data* ld = (label_data*)ec.ld;
+    float dropscale = n.dropout ? 2.0f : 1.0f;
+    uint32_t units = n.inpass ? n.k + 1 : n.k;
+    uint32_t stride = all.reg.stride;
+    weight* weights = all.reg.weight_vector;
+    size_t mask = all.reg.weight_mask;
+
+    float* hidden_units = (float*) alloca (units * sizeof (float));
+    float* sigmah = (float*) alloca (n.k * sizeof (float));
+    float* delta = (float*) alloca (units * sizeof (float));
+    bool* dropped_out = (bool*) alloca (n.k * sizeof (bool));
+    weight** output = (weight**) alloca ((n.k + 1) * sizeof (weight*));
+
+    for (unsigned int i = 0; i < n.k; ++i)
+      {
+        uint32_t biasindex = (uint32_t) constant * all.wpp * stride + i * (uint32_t)n.increment + ec.ft_offset;
+        weight* w = &weights[biasindex & mask];
+
+        // avoid saddle point at 0
+        if (*w == 0)
+          w[0] = (float) (frand48 () - 0.5);
+      }
+
+    for (unsigned int i = 0; i <= n.k; ++i)
+      {
+        uint32_t nuindex = nn_constant * stride + (i + n.k) * (uint32_t)n.increment + ec.ft_offset;
+        output[i] = &weights[nuindex & mask];
+
+        // avoid saddle point at 0
+        if (i < n.k && *output[i] == 0)
+          *output[i] = (float) (frand48 () - 0.5) / sqrt ((float)n.k);
+      }
+
+    memset (hidden_units, 0, units * sizeof (float));
+    dense_sweep d = { hidden_units, units, stride, weights, mask, 0.f, NULL };
+    GD::foreach_feature<dense_sweep, hidden_sweep<false> >(all, ec, d);
+    fasttanh_layer (sigmah, hidden_units, n.k);
+
+    for (unsigned int i = 0; i < n.k; ++i)
+      dropped_out[i] = (n.dropout && merand48 (n.xsubi) < 0.5);
+
+    float save_partial_prediction = 0;
+    float save_final_prediction = 0;
+    float save_ec_loss = 0;
+
+    for (int converse = 0; converse < (n.dropout ? 2 : 1); ++converse)
+      {
+        float partial_prediction = ld->initial + (n.inpass ? hidden_units[n.k] : *output[n.k]);
+        for (unsigned int i = 0; i < n.k; ++i)
+          if (! dropped_out[i])
+            partial_prediction += *output[i] * dropscale * sigmah[i];
+
+        float final_prediction = GD::finalize_prediction (all, partial_prediction);
+        float loss = 0;
+        if (ld->label != FLT_MAX)
+          loss = all.loss->getLoss (all.sd, final_prediction, ld->label) * ld->weight;
+
+        if (converse == 0)
+          {
+            save_partial_prediction = partial_prediction;
+            save_final_prediction = final_prediction;
+            save_ec_loss = loss;
+          }
+
+        if (is_learn && all.training && ld->label != FLT_MAX && ! ec.test_only)
+          {
+            all.set_minmax (all.sd, ld->label);
+            float gradient = ld->weight * all.loss->first_derivative (all.sd, final_prediction, ld->label);
+
+            if (fabs (gradient) > 0)
+              {
+                float eta = all.eta;
+                if (! all.adaptive && all.power_t != 0)
+                  eta *= powf ((float)(ec.example_t - all.sd->weighted_holdout_examples), -all.power_t);
+
+                // hidden gradients use the output weights before they move
+                for (unsigned int i = 0; i < n.k; ++i)
+                  delta[i] = dropped_out[i] ? 0.f : gradient * *output[i] * dropscale * (1.0f - sigmah[i] * sigmah[i]);
+                if (n.inpass)
+                  delta[n.k] = gradient;
+
+                for (unsigned int i = 0; i < n.k; ++i)
+                  if (! dropped_out[i])
+                    {
+                      if (all.adaptive)
+                        sgd_step<true> (output[i], gradient * dropscale * sigmah[i], eta);
+                      else
+                        sgd_step<false> (output[i], gradient * dropscale * sigmah[i], eta);
+                    }
+                if (! n.inpass)
+                  {
+                    if (all.adaptive)
+                      sgd_step<true> (output[n.k], gradient, eta);
+                    else
+                      sgd_step<false> (output[n.k], gradient, eta);
+                  }
+
+                d.h = delta;
+                d.eta = eta;
+                if (all.adaptive)
+                  GD::foreach_feature<dense_sweep, hidden_update<true> >(all, ec, d);
+                else
+                  GD::foreach_feature<dense_sweep, hidden_update<false> >(all, ec, d);
+              }
+          }
+
+        for (unsigned int i = 0; i < n.k; ++i)
+          dropped_out[i] = ! dropped_out[i];
+      }
+
+    if (shouldOutput) {
+      string outputString;
+      stringstream outputStringStream(outputString);
+      for (unsigned int i = 0; i < n.k; ++i) {
+        if (i > 0) outputStringStream << ' ';
+        outputStringStream << i << ':' << hidden_units[i] << ',' << sigmah[i];
+      }
+      outputStringStream << ' ' << save_partial_prediction;
+      all.print_text(all.raw_prediction, outputStringStream.str(), ec.tag);
+    }
+
+    ec.partial_prediction = save_partial_prediction;
+    ec.final_prediction = save_final_prediction;
+    ec.loss = save_ec_loss;
+  }
+
+  // hidden layer of the deep network for one example: one sweep over the
+  // features, optionally remembering them for the batch update
+  void deep_hidden(nn& n, example& ec, float* hidden_units, float* sigmah, uint32_t units, bool record)
+  {
+    vw& all = *n.all;
+    uint32_t stride = all.reg.stride;
+    for (unsigned int i = 0; i < n.k; ++i)
+      {
+        uint32_t biasindex = (uint32_t) constant * all.wpp * stride + i * (uint32_t)n.increment + ec.ft_offset;
+        weight* w = &all.reg.weight_vector[biasindex & all.reg.weight_mask];
+
+        // avoid saddle point at 0
+        if (*w == 0)
+          w[0] = (float) (frand48 () - 0.5);
+      }
+
+    memset (hidden_units, 0, units * sizeof (float));
+    dense_sweep d = { hidden_units, units, stride, all.reg.weight_vector, all.reg.weight_mask, 0.f, &n.inputs };
+    if (record)
+      {
+        GD::foreach_feature<dense_sweep, hidden_sweep<true> >(all, ec, d);
+        n.input_ends.push_back(n.inputs.size());
+      }
+    else
+      GD::foreach_feature<dense_sweep, hidden_sweep<false> >(all, ec, d);
+    fasttanh_layer (sigmah, hidden_units, n.k);
+  }
+
+  // The dense layers are kept apart from the regular weight vector, so that
+  // no hashed feature or hidden bias can land on them.  Each ft_offset gets
+  // one run of weights, each layer's weights row by row followed by its
+  // biases, with the squared gradient sum after each weight as in gd.
+  // save_load writes the runs with the model.  Runs are found by ft_offset
+  // divided by the stride, which like gd's saved weights does not change when
+  // a model trained with a wider stride is read back with -t.
+  weight* deep_alloc(nn& n, uint32_t problem)
+  {
+    size_t span = n.offsets[n.depth + 1] * deep_stride;
+    size_t first = n.layers.size();
+    for (size_t i = 0; i < span; ++i)
+      n.layers.push_back(0.f);
+    n.initialized.push_back(problem);
+    return n.layers.begin + first;
+  }
+
+  weight* deep_weights(nn& n, uint32_t ft_offset)
+  {
+    size_t span = n.offsets[n.depth + 1] * deep_stride;
+    uint32_t problem = ft_offset / n.all->reg.stride;
+    for (size_t j = 0; j < n.initialized.size(); ++j)
+      if (n.initialized[j] == problem)
+        return n.layers.begin + j * span;
+
+    // avoid the saddle point at 0
+    weight* w = deep_alloc (n, problem);
+    for (uint32_t l = 1; l <= n.depth; ++l)
+      {
+        uint32_t in = n.sizes[l-1];
+        for (size_t i = n.offsets[l]; i < n.offsets[l] + n.sizes[l] * in; ++i)
+          w[i * deep_stride] = (float) (2 * frand48 () - 1) * sqrt (3.0f / in);
+      }
+    return w;
+  }
+
+  void save_load(nn& n, io_buf& model_file, bool read, bool text)
+  {
+    if (n.depth == 0 || model_file.files.size() == 0)
+      return;
+
+    if (read)
+      {
+        n.initialized.erase();
+        n.layers.erase();
+      }
+    char buff[512];
+    uint32_t count = (uint32_t)n.initialized.size();
+    uint32_t text_len = sprintf(buff, "dense layers:%u\n", count);
+    bin_text_read_write_fixed(model_file, (char *)&count, sizeof (count),
+                              "", read,
+                              buff, text_len, text);
+    size_t span = n.offsets[n.depth + 1] * deep_stride;
+    for (uint32_t j = 0; j < count; ++j)
+      {
+        uint32_t problem = read ? 0 : n.initialized[j];
+        text_len = sprintf(buff, "problem:%u\n", problem);
+        bin_text_read_write_fixed(model_file, (char *)&problem, sizeof (problem),
+                                  "", read,
+                                  buff, text_len, text);
+        weight* w = read ? deep_alloc (n, problem) : n.layers.begin + j * span;
+        for (size_t i = 0; i < span; i += deep_stride)
+          {
+            text_len = sprintf(buff, "%lu:%f\n", (unsigned long)(i / deep_stride), w[i]);
+            bin_text_read_write_fixed(model_file, (char *)(w + i), deep_stride * sizeof (weight),
+                                      "", read,
+                                      buff, text_len, text);
+          }
+      }
+  }
+
+  // runs the dense layers on the batch row whose hidden layer is already in
+  // acts and returns the network output before passthrough
+  float deep_forward(nn& n, weight* weights, size_t row)
+  {
+    for (uint32_t l = 1; l <= n.depth; ++l)
+      {
+        uint32_t in = n.sizes[l-1], out = n.sizes[l];
+        const float* a = n.acts.begin + n.act_offsets[l-1] + row * in;
+        float* z = n.acts.begin + n.act_offsets[l] + row * out;
+        const weight* w = weights + n.offsets[l] * deep_stride;
+        const weight* bias = w + out * in * deep_stride;
+        for (uint32_t o = 0; o < out; ++o)
+          {
+            float sum = bias[o * deep_stride];
+            const weight* wo = w + o * in * deep_stride;
+            for (uint32_t j = 0; j < in; ++j)
+              sum += wo[j * deep_stride] * a[j];
+            z[o] = sum;
+          }
+        if (l < n.depth)
+          fasttanh_layer (z, z, out);
+      }
+    return n.acts[n.act_offsets[n.depth] + row];
+  }
+
+  // backpropagates the pending examples together and applies their updates
+  void deep_flush(nn& n)
+  {
+    if (n.pending == 0)
+      return;
+    vw& all = *n.all;
+    uint32_t stride = all.reg.stride;
+    size_t rows = n.pending;
+    weight* weights = deep_weights (n, n.batch_offset);
+
+    float eta = all.eta;
+    if (! all.adaptive && all.power_t != 0)
+      eta *= powf ((float)(all.sd->t - all.sd->weighted_holdout_examples), -all.power_t);
+
+    memcpy (n.deltas.begin + n.act_offsets[n.depth], n.gradients.begin, rows * sizeof (float));
+    for (uint32_t l = n.depth; l > 0; --l)
+      {
+        uint32_t in = n.sizes[l-1], out = n.sizes[l];
+        size_t len = out * (in + 1);
+        weight* w = weights + n.offsets[l] * deep_stride;
+        const float* a = n.acts.begin + n.act_offsets[l-1];
+        const float* delta = n.deltas.begin + n.act_offsets[l];
+        float* below = n.deltas.begin + n.act_offsets[l-1];
+
+        // the layer below sees these weights before they move
+        for (size_t i = 0; i < out * in; ++i)
+          n.grad2[i] = w[i * deep_stride];
+        memset (below, 0, rows * in * sizeof (float));
+        gemm (false, rows, in, out, delta, n.grad2.begin, below);
+        for (size_t i = 0; i < rows * in; ++i)
+          below[i] *= 1.0f - a[i] * a[i];
+
+        memset (n.grad.begin, 0, len * sizeof (float));
+        gemm (true, out, in, rows, delta, a, n.grad.begin);
+        float* bias_grad = n.grad.begin + out * in;
+        for (size_t r = 0; r < rows; ++r)
+          for (uint32_t o = 0; o < out; ++o)
+            bias_grad[o] += delta[r * out + o];
+
+        if (all.adaptive)
+          {
+            // per example squared gradients summed over the batch, so that a
+            // batch step is the sum of the per example steps
+            float* sq_delta = n.squares.begin;
+            float* sq_a = sq_delta + rows * out;
+            for (size_t i = 0; i < rows * out; ++i)
+              sq_delta[i] = delta[i] * delta[i];
+            for (size_t i = 0; i < rows * in; ++i)
+              sq_a[i] = a[i] * a[i];
+            memset (n.grad2.begin, 0, len * sizeof (float));
+            gemm (true, out, in, rows, sq_delta, sq_a, n.grad2.begin);
+            float* bias_sq = n.grad2.begin + out * in;
+            for (size_t r = 0; r < rows; ++r)
+              for (uint32_t o = 0; o < out; ++o)
+                bias_sq[o] += sq_delta[r * out + o];
+
+            for (size_t i = 0; i < len; ++i)
+              {
+                weight* wi = w + i * deep_stride;
+                wi[1] += n.grad2[i];
+                if (wi[1] > 0)
+                  wi[0] -= eta * n.grad[i] / sqrtf (wi[1]);
+              }
+          }
+        else
+          for (size_t i = 0; i < len; ++i)
+            w[i * deep_stride] -= eta * n.grad[i];
+      }
+
+    uint32_t units = n.inpass ? n.k + 1 : n.k;
+    float* h = (float*) alloca (units * sizeof (float));
+    dense_sweep d = { h, units, stride, all.reg.weight_vector, all.reg.weight_mask, eta, NULL };
+    size_t begin = 0;
+    for (size_t r = 0; r < rows; ++r)
+      {
+        memcpy (h, n.deltas.begin + n.act_offsets[0] + r * n.k, n.k * sizeof (float));
+        if (n.inpass)
+          h[n.k] = n.gradients[r];
+        for (size_t f = begin; f < n.input_ends[r]; ++f)
+          if (all.adaptive)
+            update_block<true> (d, n.inputs[f].x, n.inputs[f].weight_index);
+          else
+            update_block<false> (d, n.inputs[f].x, n.inputs[f].weight_index);
+        begin = n.input_ends[r];
+      }
+
+    n.pending = 0;
+    n.inputs.erase();
+    n.input_ends.erase();
+  }
+
+  template <bool is_learn>
+  void deep_predict_or_learn(nn& n, learner& base, example& ec)
+  {
+    vw& all = *n.all;
+    bool shouldOutput = all.raw_prediction > 0;
+    label_data* ld = (label_data*)ec.ld;
+    uint32_t units = n.inpass ? n.k + 1 : n.k;
+    bool train = is_learn && all.training && ld->label != FLT_MAX && ! ec.test_only;
+
+    // a batch shares one set of dense layers
+    if (train && n.pending > 0 && n.batch_offset != ec.ft_offset)
+      deep_flush (n);
+
+    float* hidden_units = (float*) alloca (units * sizeof (float));
+    float* sigmah = n.acts.begin + n.act_offsets[0] + n.pending * n.k;
+    deep_hidden (n, ec, hidden_units, sigmah, units, train);
+
+    float partial_prediction = ld->initial + deep_forward (n, deep_weights (n, ec.ft_offset), n.pending);
+    if (n.inpass)
+      partial_prediction += hidden_units[n.k];
+    ec.partial_prediction = partial_prediction;
+    ec.final_prediction = GD::finalize_prediction (all, partial_prediction);
+    ec.loss = 0;
+    if (ld->label != FLT_MAX)
+      ec.loss = all.loss->getLoss (all.sd, ec.final_prediction, ld->label) * ld->weight;
+
+    if (shouldOutput) {
+      string outputString;
+      stringstream outputStringStream(outputString);
+      for (unsigned int i = 0; i < n.k; ++i) {
+        if (i > 0) outputStringStream << ' ';
+        outputStringStream << i << ':' << hidden_units[i] << ',' << sigmah[i];
+      }
+      outputStringStream << ' ' << partial_prediction;
+      all.print_text(all.raw_prediction, outputStringStream.str(), ec.tag);
+    }
+
+    if (train)
+      {
+        all.set_minmax (all.sd, ld->label);
+        n.batch_offset = ec.ft_offset;
+        n.gradients[n.pending++] = ld->weight * all.loss->first_derivative (all.sd, ec.final_prediction, ld->label);
+        if (n.pending == n.batch)
+          deep_flush (n);
+      }
+  }
+
+  void deep_setup(nn& n, string layers)
+  {
+    n.sizes.push_back(n.k);
+    stringstream ss(layers);
+    string size;
+    while (getline(ss, size, ','))
+      if (atoi(size.c_str()) > 0)
+        n.sizes.push_back((uint32_t)atoi(size.c_str()));
+    n.sizes.push_back(1);
+    n.depth = (uint32_t)n.sizes.size() - 1;
+
+    size_t total = 0, widest = 0, largest = 0;
+    n.offsets.push_back(0);
+    for (uint32_t l = 1; l <= n.depth; ++l)
+      {
+        size_t len = n.sizes[l] * (n.sizes[l-1] + 1);
+        n.offsets.push_back(total);
+        total += len;
+        largest = max (largest, len);
+        widest = max (widest, (size_t)(n.sizes[l] + n.sizes[l-1]));
+      }
+    n.offsets.push_back(total);
+
+    size_t acts = 0;
+    for (uint32_t l = 0; l <= n.depth; ++l)
+      {
+        n.act_offsets.push_back(acts);
+        acts += n.batch * n.sizes[l];
+      }
+    n.acts.resize(acts, true);
+    n.deltas.resize(acts, true);
+    n.gradients.resize(n.batch, true);
+    n.grad.resize(largest, true);
+    n.grad2.resize(largest, true);
+    n.squares.resize(n.batch * widest, true);
+  }
+
+  void end_examples(nn& n)
+  {
+    deep_flush (n);
+  }
+
   void finish_example(vw& all, nn&, example& ec)
   {
     int save_raw_prediction = all.raw_prediction;
@@ -299,6 +870,19 @@ CONVERSE: // That's right, I'm using goto.  So sue me.
 
   void finish(nn& n)
   {
+    n.sizes.delete_v();
+    n.offsets.delete_v();
+    n.initialized.delete_v();
+    n.layers.delete_v();
+    n.grad.delete_v();
+    n.grad2.delete_v();
+    n.squares.delete_v();
+    n.act_offsets.delete_v();
+    n.acts.delete_v();
+    n.deltas.delete_v();
+    n.gradients.delete_v();
+    n.inputs.delete_v();
+    n.input_ends.delete_v();
     delete n.squared_loss;
     free (n.output_layer.indices.begin);
     free (n.output_layer.atomics[nn_output_namespace].begin);
@@ -313,7 +897,10 @@ CONVERSE: // That's right, I'm using goto.  So sue me.
     desc.add_options()
       ("inpass", "Train or test sigmoidal feedforward network with input passthrough.")
       ("dropout", "Train or test sigmoidal feedforward network using dropout.")
-      ("meanfield", "Train or test sigmoidal feedforward network using mean field.");
+      ("meanfield", "Train or test sigmoidal feedforward network using mean field.")
+      ("dense_hidden", "Compute all hidden units in one sweep over the features, trained by SGD (AdaGrad with --adaptive) without the base learner.")
+      ("nn_layers", po::value<string>(), "Comma separated sizes of dense layers to add after the hidden layer, e.g. 32,16.  Implies --dense_hidden.")
+      ("nn_batch", po::value<size_t>(), "Minibatch size for training with --nn_layers.");
 
     po::parsed_options parsed = po::command_line_parser(opts).
       style(po::command_line_style::default_style ^ po::command_line_style::allow_guessing).
@@ -387,6 +974,50 @@ CONVERSE: // That's right, I'm using goto.  So sue me.
                 << (all.training ? "training" : "testing") 
                 << std::endl;
 
+    if( vm_file.count("dense_hidden") ) {
+      n->dense = true;
+    }
+    else if (vm.count ("dense_hidden")) {
+      n->dense = true;
+
+      std::stringstream ss;
+      ss << " --dense_hidden";
+      all.options_from_file.append(ss.str());
+    }
+
+    string layers;
+    if( vm_file.count("nn_layers") ) {
+      layers = vm_file["nn_layers"].as<string>();
+    }
+    else if (vm.count ("nn_layers")) {
+      layers = vm["nn_layers"].as<string>();
+
+      std::stringstream ss;
+      ss << " --nn_layers " << layers;
+      all.options_from_file.append(ss.str());
+    }
+
+    if (layers.size() > 0) {
+      n->dense = true;
+      n->batch = vm.count("nn_batch") ? max ((uint32_t)vm["nn_batch"].as<size_t>(), 1u) : 1;
+      if (n->dropout) {
+        n->dropout = false;
+        std::cerr << "warning: dropout is not supported with --nn_layers, using mean field" << endl;
+      }
+    }
+    else if (vm.count("nn_batch"))
+      std::cerr << "warning: --nn_batch only applies with --nn_layers" << endl;
+
+    if (n->dense && all.bfgs) {
+      n->dense = false;
+      std::cerr << "warning: --dense_hidden trains by gradient descent only, ignoring it with --bfgs" << endl;
+    }
+
+    if (n->dense && ! all.quiet)
+      std::cerr << "using dense hidden layer for neural network "
+                << (all.training ? "training" : "testing")
+                << std::endl;
+
     n->finished_setup = false;
     n->squared_loss = getLossFunction (0, "squared", 0);
 
@@ -397,9 +1028,26 @@ CONVERSE: // That's right, I'm using goto.  So sue me.
 
     n->save_xsubi = n->xsubi;
     n->increment = all.l->increment;//Indexing of output layer is odd.
+    if (n->dense && layers.size() > 0)
+      deep_setup(*n, layers);
     learner* l = new learner(n,  all.l, n->k+1);
-    l->set_learn<nn, predict_or_learn<true> >();
-    l->set_predict<nn, predict_or_learn<false> >();
+    l->reads_features = true;
+    if (n->dense && layers.size() > 0) {
+      if (! all.quiet)
+        std::cerr << "using " << n->depth - 1 << " dense layers after the hidden layer, minibatch " << n->batch << std::endl;
+      l->set_learn<nn, deep_predict_or_learn<true> >();
+      l->set_predict<nn, deep_predict_or_learn<false> >();
+      l->set_end_examples<nn, end_examples>();
+    }
+    else if (n->dense) {
+      l->set_learn<nn, dense_predict_or_learn<true> >();
+      l->set_predict<nn, dense_predict_or_learn<false> >();
+    }
+    else {
+      l->set_learn<nn, predict_or_learn<true> >();
+      l->set_predict<nn, predict_or_learn<false> >();
+    }
+    l->set_save_load<nn, save_load>();
     l->set_finish<nn, finish>();
     l->set_finish_example<nn, finish_example>();
     l->set_end_pass<nn,end_pass>();
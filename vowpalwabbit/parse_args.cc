@@ -27,6 +27,7 @@ license as described in the file LICENSE.
 #include "cb.h"
 #include "cb_algs.h"
 #include "scorer.h"
+#include "profile.h"
 #include "searn.h"
 #include "bfgs.h"
 #include "lda_core.h"
@@ -126,6 +127,9 @@ vw* parse_args(int argc, char *argv[])
     ("cache,c", "Use a cache.  The default is <data>.cache")
     ("cache_file", po::value< vector<string> >(), "The location(s) of cache_file.")
     ("kill_cache,k", "do not reuse existing cache: create a new one always")
+    ("in_memory", "keep examples in memory after the first pass, so multiple passes need no cache file")
+    ("in_memory_cap", po::value<size_t>(), "memory limit in MB for --in_memory; beyond it examples spill to <data>.cache")
+    ("in_memory_shuffle", "replay the in-memory examples in a new random order each pass")
     ("compressed", "use gzip format whenever possible. If a cache file is being created, this option creates a compressed cache file. A mixture of raw-text & compressed inputs are supported with autodetection.")
     ("no_stdin", "do not default to reading from stdin")
     ("save_resume", "save extra state so learning can be resumed later with new data")
@@ -143,6 +147,8 @@ vw* parse_args(int argc, char *argv[])
     ("binary", "report loss as binary classification on -1,1")
     ("min_prediction", po::value<float>(&(all->sd->min_label)), "Smallest prediction to output")
     ("max_prediction", po::value<float>(&(all->sd->max_label)), "Largest prediction to output")
+    ("profile", "report the calls and time of each learner of the stack, the parser's stalls and the allreduce traffic at exit")
+    ("profile_json", po::value< string >(), "also write the --profile report to this file as json")
     ;
 
   po::options_description update_opt("Update options");
@@ -152,6 +158,8 @@ vw* parse_args(int argc, char *argv[])
     ("hessian_on", "use second derivative in line search")
     ("bfgs", "use bfgs optimization")
     ("mem", po::value<int>(&(all->m)), "memory in bfgs")
+    ("mem_sparse", "store bfgs history only for weights seen in the first pass")
+    ("mem_bf16", "store bfgs history as 16 bit bfloat16 values")
     ("termination", po::value<float>(&(all->rel_threshold)),"Termination threshold")
     ("adaptive", "use adaptive, individual learning rates.")
     ("invariant", "use safe/importance aware updates.")
@@ -224,6 +232,7 @@ vw* parse_args(int argc, char *argv[])
   lrq_opt.add_options()
     ("lrq", po::value<vector<string> > (), "use low rank quadratic features")
     ("lrqdropout", "use dropout training for low rank quadratic features")
+    ("lrqfactored", "compute low rank quadratic terms from factor sums instead of adding features")
     ;
 
   po::options_description multiclass_opt("Multiclass options");
@@ -834,26 +843,6 @@ vw* parse_args(int argc, char *argv[])
   if (vm.count("sendto"))
     all->l = SENDER::setup(*all, vm, all->pairs);
 
-  // Need to see if we have to load feature mask first or second.
-  // -i and -mask are from same file, load -i file first so mask can use it
-  if (vm.count("feature_mask") && vm.count("initial_regressor")
-      && vm["feature_mask"].as<string>() == vm["initial_regressor"].as< vector<string> >()[0]) {
-    // load rest of regressor
-    all->l->save_load(io_temp, true, false);
-    io_temp.close_file();
-
-    // set the mask, which will reuse -i file we just loaded
-    parse_mask_regressor_args(*all, vm);
-  }
-  else {
-    // load mask first
-    parse_mask_regressor_args(*all, vm);
-
-    // load rest of regressor
-    all->l->save_load(io_temp, true, false);
-    io_temp.close_file();
-  }
-
   bool got_mc = false;
   bool got_cs = false;
   bool got_cb = false;
@@ -995,6 +984,28 @@ vw* parse_args(int argc, char *argv[])
   if(vm.count("bs") || vm_file.count("bs") )
     all->l = BS::setup(*all, to_pass_further, vm, vm_file);
 
+  // The model is read once the whole learner stack is set up, so that
+  // reductions which save state of their own (nn's dense layers) read it too.
+  // Need to see if we have to load feature mask first or second.
+  // -i and -mask are from same file, load -i file first so mask can use it
+  if (vm.count("feature_mask") && vm.count("initial_regressor")
+      && vm["feature_mask"].as<string>() == vm["initial_regressor"].as< vector<string> >()[0]) {
+    // load rest of regressor
+    all->l->save_load(io_temp, true, false);
+    io_temp.close_file();
+
+    // set the mask, which will reuse -i file we just loaded
+    parse_mask_regressor_args(*all, vm);
+  }
+  else {
+    // load mask first
+    parse_mask_regressor_args(*all, vm);
+
+    // load rest of regressor
+    all->l->save_load(io_temp, true, false);
+    io_temp.close_file();
+  }
+
   if (to_pass_further.size() > 0) {
     bool is_actually_okay = false;
 
@@ -1028,6 +1039,9 @@ vw* parse_args(int argc, char *argv[])
 
   parse_source_args(*all, vm, all->quiet,all->numpasses);
 
+  if (vm.count("profile") || vm.count("profile_json"))
+    PROFILE::setup(*all, vm.count("profile_json") ? vm["profile_json"].as<string>() : "");
+
   // force wpp to be a power of 2 to avoid 32-bit overflow
   uint32_t i = 0;
   size_t params_per_problem = all->l->increment;
@@ -1113,6 +1127,8 @@ namespace VW {
 
   void finish(vw& all)
   {
+    if (all.profile)
+      PROFILE::finish(all);
     finalize_regressor(all, all.final_regressor_name);
     all.l->finish();
     delete all.l;
@@ -77,6 +77,9 @@ struct label_parser {
 
 typedef size_t (*hash_func_t)(substring, uint32_t);
 
+struct example_store;
+namespace PROFILE { struct parser_stats; }
+
 struct parser {
   v_array<substring> channels;//helper(s) for text parsing
   v_array<substring> words;
@@ -90,6 +93,7 @@ struct parser {
   bool write_cache; 
   bool sort_features;
   bool sorted_cache;
+  example_store* store; //examples kept in memory across passes (--in_memory)
 
   size_t ring_size;
   uint64_t parsed_examples; // The index of the parsed example.
@@ -97,6 +101,7 @@ struct parser {
   uint32_t in_pass_counter;
   example* examples;
   uint64_t used_index;
+  PROFILE::parser_stats* stats; //NULL unless --profile
   bool emptylines_separate_examples; // true if you want to have holdout computed on a per-block basis rather than a per-line basis
   MUTEX examples_lock;
   CV example_available;
@@ -56,6 +56,7 @@ namespace po = boost::program_options;
 #include "example.h"
 #include "simple_label.h"
 #include "vw.h"
+#include "profile.h"
 
 using namespace std;
 
@@ -244,6 +245,22 @@ void reset_source(vw& all, size_t numbits)
       input->open_file(all.p->output->finalname.begin, all.stdin_off, io_buf::READ); //pushing is merged into open_file
       all.p->reader = read_cached_features;
     }
+  if (all.p->store != NULL)
+    {
+      if (all.p->store->recording)
+	{
+	  seal_store(*all.p->store);
+	  while(input->files.size() > 0)
+	    {
+	      int fd = input->files.pop();
+	      if (!member(all.final_prediction_sink, (size_t) fd))
+		io_buf::close_file_or_socket(fd);
+	    }
+	  all.p->reader = read_memory_features;
+	}
+      start_memory_pass(*all.p->store);
+      return;
+    }
   if ( all.p->resettable == true )
     {
       if (all.daemon)
@@ -306,6 +323,11 @@ void finalize_source(parser* p)
   p->input->close_files();
 
   delete p->input;
+  if (p->store != NULL)
+    {
+      delete_store(p->store);
+      p->store = NULL;
+    }
   p->output->close_files();
   delete p->output;
 }
@@ -340,6 +362,29 @@ void make_write_cache(vw& all, string &newname, bool quiet)
     cerr << "creating cache_file = " << newname << endl;
 }
 
+// the in-memory store outgrew --in_memory_cap: hand the remaining passes to a
+// cache file, seeded with what has been stored so far
+void spill_store(vw& all)
+{
+  example_store* store = all.p->store;
+  if (!store->backed && !all.p->write_cache)
+    {
+      string cache = all.data_filename + string(".cache");
+      all.p->output->init(); // parse_cache released the buffer when no cache was asked for
+      make_write_cache(all, cache, all.quiet);
+      if (!all.p->write_cache)
+	{
+	  cerr << all.program_name << ": --in_memory_cap exceeded and no cache file could be created" << endl;
+	  throw exception();
+	}
+      write_store(*store, *all.p->output, (uint32_t)all.parse_mask);
+    }
+  if (!all.quiet)
+    cerr << "in-memory examples exceed " << (store->cap >> 20) << "M, continuing from the cache file" << endl;
+  delete_store(store);
+  all.p->store = NULL;
+}
+
 void parse_cache(vw& all, po::variables_map &vm, string source,
 		 bool quiet)
 {
@@ -608,6 +653,18 @@ void parse_source_args(vw& all, po::variables_map& vm, bool quiet, size_t passes
 	}
     }
 
+  if (vm.count("in_memory") && passes > 1)
+    {
+      if (all.daemon || all.active)
+	cerr << "warning: --in_memory is ignored in daemon and active mode" << endl;
+      else
+	{
+	  size_t cap = vm.count("in_memory_cap") ? vm["in_memory_cap"].as<size_t>() << 20 : 0;
+	  all.p->store = new_store(cap, vm.count("in_memory_shuffle") > 0, all.p->resettable);
+	  all.p->resettable = true;
+	}
+    }
+
   if (passes > 1 && !all.p->resettable)
     {
       cerr << all.program_name << ": need a cache file for multiple passes: try using --cache_file" << endl;  
@@ -708,6 +765,13 @@ example* get_unused_example(vw& all)
 	  mutex_unlock(&all.p->examples_lock);
 	  return all.p->examples + (all.p->parsed_examples % all.p->ring_size);
 	}
+      else if (all.p->stats)
+	{
+	  uint64_t start = PROFILE::ticks();
+	  condition_variable_wait(&all.p->example_unused, &all.p->examples_lock);
+	  all.p->stats->parser_wait_ticks += PROFILE::ticks() - start;
+	  all.p->stats->parser_waits++;
+	}
       else 
 	condition_variable_wait(&all.p->example_unused, &all.p->examples_lock);
       mutex_unlock(&all.p->examples_lock);
@@ -728,6 +792,14 @@ bool parse_atomic_example(vw& all, example* ae, bool do_read = true)
       cache_features(*(all.p->output), ae, (uint32_t)all.parse_mask);
     }
 
+  example_store* store = all.p->store;
+  if (store != NULL && store->recording)
+    {
+      store_example(*store, all.p->lp, ae, all.p->in_pass_counter);
+      if (store->cap != 0 && store->arena.space.size() > store->cap)
+	spill_store(all);
+    }
+
   return true;
 }
 
@@ -1020,6 +1092,7 @@ void *main_parse_loop(void *in)
 	while(!all->p->done)
 	  {
             example* ae = get_unused_example(*all);
+	    uint64_t start = all->p->stats ? PROFILE::ticks() : 0;
 	    if (!all->do_reset_source && example_number != all->pass_length && all->max_examples > example_number
 		   && parse_atomic_example(*all, ae) )
 	     {
@@ -1045,6 +1118,8 @@ void *main_parse_loop(void *in)
 			 }
 	       example_number = 0;
 	     }
+	   if (all->p->stats)
+	     all->p->stats->parse_ticks += PROFILE::ticks() - start;
 	   mutex_lock(&all->p->examples_lock);
 	   all->p->parsed_examples++;
 	   condition_variable_signal_all(&all->p->example_available);
@@ -1059,6 +1134,14 @@ example* get_example(parser* p)
 {
   mutex_lock(&p->examples_lock);
   if (p->parsed_examples != p->used_index) {
+    if (p->stats)
+      {
+	uint64_t occupancy = p->parsed_examples - p->used_index;
+	p->stats->ring_samples++;
+	p->stats->ring_occupancy += occupancy;
+	if (occupancy > p->stats->ring_max)
+	  p->stats->ring_max = occupancy;
+      }
     size_t ring_index = p->used_index++ % p->ring_size;
     if (!(p->examples+ring_index)->in_use)
       cout << p->used_index << " " << p->parsed_examples << " " << ring_index << endl;
@@ -1070,7 +1153,15 @@ example* get_example(parser* p)
   else {
     if (!p->done)
       {
-	condition_variable_wait(&p->example_available, &p->examples_lock);
+	if (p->stats)
+	  {
+	    uint64_t start = PROFILE::ticks();
+	    condition_variable_wait(&p->example_available, &p->examples_lock);
+	    p->stats->learner_wait_ticks += PROFILE::ticks() - start;
+	    p->stats->learner_waits++;
+	  }
+	else
+	  condition_variable_wait(&p->example_available, &p->examples_lock);
 	mutex_unlock(&p->examples_lock);
 	return get_example(p);
       }
@@ -0,0 +1,275 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD (revised)
+license as described in the file LICENSE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <sys/timeb.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+#include <vector>
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
+
+#include "vw.h"
+#include "profile.h"
+
+using namespace std;
+using namespace LEARNER;
+
+namespace PROFILE {
+
+  // the counts of one learner of the stack.  Its ticks include the timed
+  // calls it made to other learners, its self_ticks leave them out.
+  struct layer {
+    string name;
+    learn_data own;
+    uint64_t learn_calls;
+    uint64_t predict_calls;
+    uint64_t update_calls;
+    uint64_t multipredict_calls;
+    uint64_t ticks;
+    uint64_t self_ticks;
+  };
+
+  struct profile {
+    vector<layer*> layers; //the top of the stack first
+    parser_stats parser;
+    string json_file;
+    uint64_t start_ticks;
+    double start_seconds;
+  };
+
+  double seconds_now()
+  {
+#ifdef _WIN32
+    struct timeb t;
+    ftime(&t);
+    return t.time + t.millitm / 1000.;
+#else
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec / 1e6;
+#endif
+  }
+
+  // the most memory the process has held, in kilobytes, or 0 where that
+  // is not known
+  long peak_rss_kb()
+  {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+  }
+
+  // the name of the learner's state type, without its namespace
+  string layer_name(const char* type)
+  {
+    if (type == NULL)
+      return "?";
+    string name = type;
+#ifdef __GNUG__
+    int status;
+    char* demangled = abi::__cxa_demangle(type, NULL, NULL, &status);
+    if (status == 0)
+      name = demangled;
+    free(demangled);
+#endif
+    size_t colon = name.rfind("::");
+    if (colon != string::npos)
+      name = name.substr(colon + 2);
+    size_t space = name.rfind(' ');
+    if (space != string::npos)
+      name = name.substr(space + 1);
+    return name;
+  }
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+  // one timed call in progress.  inner adds up the timed calls made during
+  // it, whichever learners they went to, so the call's own time is exact.
+  // The calls in progress on a thread form a stack through outer.
+  struct call {
+    uint64_t start;
+    uint64_t inner;
+    call* outer;
+  };
+
+  static THREAD_LOCAL call* innermost = NULL;
+
+  inline void enter(call& c)
+  {
+    c.inner = 0;
+    c.outer = innermost;
+    innermost = &c;
+    c.start = ticks();
+  }
+
+  inline void leave(layer& l, call& c)
+  {
+    uint64_t elapsed = ticks() - c.start;
+    innermost = c.outer;
+    if (c.outer != NULL)
+      c.outer->inner += elapsed;
+    l.ticks += elapsed;
+    l.self_ticks += elapsed - c.inner;
+  }
+
+  void learn(void* d, learner& base, example& ec)
+  {
+    layer& l = *(layer*)d;
+    call c;
+    enter(c);
+    l.own.learn_f(l.own.data, base, ec);
+    leave(l, c);
+    l.learn_calls++;
+  }
+
+  void predict(void* d, learner& base, example& ec)
+  {
+    layer& l = *(layer*)d;
+    call c;
+    enter(c);
+    l.own.predict_f(l.own.data, base, ec);
+    leave(l, c);
+    l.predict_calls++;
+  }
+
+  void update(void* d, learner& base, example& ec)
+  {
+    layer& l = *(layer*)d;
+    call c;
+    enter(c);
+    l.own.update_f(l.own.data, base, ec);
+    leave(l, c);
+    l.update_calls++;
+  }
+
+  void multipredict(void* d, learner& base, example& ec, size_t count, size_t step, float* pred)
+  {
+    layer& l = *(layer*)d;
+    call c;
+    enter(c);
+    l.own.multipredict_f(l.own.data, base, ec, count, step, pred);
+    leave(l, c);
+    l.multipredict_calls++;
+  }
+
+  void setup(vw& all, string json_file)
+  {
+    profile* p = new profile;
+    memset(&p->parser, 0, sizeof(p->parser));
+    p->json_file = json_file;
+
+    for (learner* l = all.l; l != NULL; l = l->get_base())
+      {
+	layer* ly = new layer;
+	ly->name = layer_name(l->name);
+	ly->learn_calls = ly->predict_calls = ly->update_calls = ly->multipredict_calls = 0;
+	ly->ticks = ly->self_ticks = 0;
+	learn_data fd = {ly, NULL, learn, predict, update, multipredict};
+	ly->own = l->wrap(fd);
+	p->layers.push_back(ly);
+      }
+
+    all.p->stats = &p->parser;
+    all.profile = p;
+    p->start_seconds = seconds_now();
+    p->start_ticks = ticks();
+  }
+
+  void finish(vw& all)
+  {
+    profile& p = *(profile*)all.profile;
+    double seconds = seconds_now() - p.start_seconds;
+    double ticks_per_second = (ticks() - p.start_ticks) / (seconds > 0. ? seconds : 1.);
+    double examples = (double)all.sd->example_number;
+    double per_example = examples > 0. ? 1e9 / (ticks_per_second * examples) : 0.;
+    parser_stats& ps = p.parser;
+
+    vector<double> self(p.layers.size());
+    for (size_t i = 0; i < p.layers.size(); i++)
+      self[i] = (double)p.layers[i]->self_ticks;
+
+    fprintf(stderr, "\nprofile: %.0f examples in %.3f s, %.1f examples/s\n", examples, seconds, seconds > 0. ? examples / seconds : 0.);
+    fprintf(stderr, "%-12s %12s %12s %12s %12s %10s %10s %14s\n", "learner", "learn", "predict", "update", "multipredict", "total s", "self s", "self ns/example");
+    for (size_t i = 0; i < p.layers.size(); i++)
+      {
+	layer& l = *p.layers[i];
+	fprintf(stderr, "%-12s %12lu %12lu %12lu %12lu %10.3f %10.3f %14.1f\n", l.name.c_str(),
+		(unsigned long)l.learn_calls, (unsigned long)l.predict_calls, (unsigned long)l.update_calls, (unsigned long)l.multipredict_calls,
+		l.ticks / ticks_per_second, self[i] / ticks_per_second, self[i] * per_example);
+      }
+    fprintf(stderr, "parser busy %.3f s, peak rss %ld kB\n", ps.parse_ticks / ticks_per_second, peak_rss_kb());
+    fprintf(stderr, "parser stalls: learner waited %.3f s in %lu waits, parser waited %.3f s in %lu waits\n",
+	    ps.learner_wait_ticks / ticks_per_second, (unsigned long)ps.learner_waits,
+	    ps.parser_wait_ticks / ticks_per_second, (unsigned long)ps.parser_waits);
+    fprintf(stderr, "ring occupancy: mean %.1f, max %lu of %lu\n",
+	    ps.ring_samples > 0 ? (double)ps.ring_occupancy / ps.ring_samples : 0., (unsigned long)ps.ring_max, (unsigned long)all.p->ring_size);
+    if (all.socks.reduces > 0)
+      fprintf(stderr, "allreduce: %lu calls, %lu bytes in %.3f s\n",
+	      (unsigned long)all.socks.reduces, (unsigned long)all.socks.bytes, all.socks.ticks / ticks_per_second);
+
+    if (p.json_file != "")
+      {
+	FILE* f = fopen(p.json_file.c_str(), "w");
+	if (f == NULL)
+	  cerr << "can't write profile to " << p.json_file << endl;
+	else
+	  {
+	    double features = (double)all.sd->total_features;
+	    fprintf(f, "{\n  \"examples\": %.0f,\n  \"features\": %.0f,\n  \"seconds\": %f,\n  \"examples_per_second\": %f,\n  \"features_per_second\": %f,\n"
+		    "  \"ticks_per_second\": %.0f,\n  \"peak_rss_kb\": %ld,\n",
+		    examples, features, seconds, seconds > 0. ? examples / seconds : 0., seconds > 0. ? features / seconds : 0.,
+		    ticks_per_second, peak_rss_kb());
+	    fprintf(f, "  \"learners\": [\n");
+	    for (size_t i = 0; i < p.layers.size(); i++)
+	      {
+		layer& l = *p.layers[i];
+		fprintf(f, "    {\"name\": \"%s\", \"learn_calls\": %lu, \"predict_calls\": %lu, \"update_calls\": %lu, \"multipredict_calls\": %lu, "
+			"\"seconds\": %f, \"self_seconds\": %f, \"self_ns_per_example\": %f}%s\n", l.name.c_str(),
+			(unsigned long)l.learn_calls, (unsigned long)l.predict_calls, (unsigned long)l.update_calls, (unsigned long)l.multipredict_calls,
+			l.ticks / ticks_per_second, self[i] / ticks_per_second, self[i] * per_example, i+1 < p.layers.size() ? "," : "");
+	      }
+	    fprintf(f, "  ],\n");
+	    fprintf(f, "  \"parser\": {\"parse_seconds\": %f, \"learner_wait_seconds\": %f, \"learner_waits\": %lu, \"parser_wait_seconds\": %f, \"parser_waits\": %lu, "
+		    "\"ring_size\": %lu, \"ring_mean_occupancy\": %f, \"ring_max_occupancy\": %lu},\n",
+		    ps.parse_ticks / ticks_per_second, ps.learner_wait_ticks / ticks_per_second, (unsigned long)ps.learner_waits,
+		    ps.parser_wait_ticks / ticks_per_second, (unsigned long)ps.parser_waits, (unsigned long)all.p->ring_size,
+		    ps.ring_samples > 0 ? (double)ps.ring_occupancy / ps.ring_samples : 0., (unsigned long)ps.ring_max);
+	    fprintf(f, "  \"allreduce\": {\"calls\": %lu, \"bytes\": %lu, \"seconds\": %f}\n}\n",
+		    (unsigned long)all.socks.reduces, (unsigned long)all.socks.bytes, all.socks.ticks / ticks_per_second);
+	    fclose(f);
+	  }
+      }
+
+    size_t i = 0;
+    for (learner* l = all.l; l != NULL; l = l->get_base(), i++)
+      {
+	l->wrap(p.layers[i]->own);
+	delete p.layers[i];
+      }
+    all.p->stats = NULL;
+    delete &p;
+    all.profile = NULL;
+  }
+}
@@ -0,0 +1,54 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD
+license as described in the file LICENSE.
+ */
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <string>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+struct vw;
+
+namespace PROFILE {
+  // a cheap clock: the time stamp counter where there is one, nanoseconds
+  // otherwise.  Ticks are turned into seconds by the rate seen over the run.
+  inline uint64_t ticks()
+  {
+#if defined(_MSC_VER) || (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+    return __rdtsc();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+  }
+
+  // the waits of the parser and the learner on each other, and how full the
+  // ring was when the learner took an example from it
+  struct parser_stats {
+    uint64_t learner_wait_ticks;
+    uint64_t learner_waits;
+    uint64_t parser_wait_ticks;
+    uint64_t parser_waits;
+    uint64_t ring_samples;
+    uint64_t ring_occupancy; //summed over the samples
+    uint64_t ring_max;
+    uint64_t parse_ticks; //the parser reading and setting up examples
+  };
+
+  //wraps every learner of all's stack to count and time its calls
+  void setup(vw& all, std::string json_file);
+  //reports the counts as a table on stderr and, if asked, as json
+  void finish(vw& all);
+}
+
+#endif
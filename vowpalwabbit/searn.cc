@@ -7,9 +7,13 @@ license as described in the file LICENSE.
 #include <float.h>
 #include <stdio.h>
 #include <math.h>
-#ifndef _WIN32
+#ifdef _WIN32
+#include <winsock2.h>
+#include <Windows.h>
+#else
 #include <sys/types.h>
 #include <unistd.h>
+#include <pthread.h>
 #endif
 #include "searn.h"
 #include "gd.h"
@@ -21,7 +25,6 @@ license as described in the file LICENSE.
 #include "v_hashmap.h"
 #include "vw.h"
 #include "rand48.h"
-#include "beam.h"
 
 #ifdef _WIN32
 bool isfinite(float x)
@@ -69,10 +72,11 @@ namespace Searn
       free(ptr);
   }
 
-  int random_policy(uint64_t seed, float beta, bool allow_current_policy, int current_policy, bool allow_optimal, bool reset_seed)
+  int random_policy(uint64_t seed, float beta, bool allow_current_policy, int current_policy, bool allow_optimal, bool reset_seed, bool global_seed)
   {
-    if(reset_seed) //reset_seed is false for contextual bandit, so that we only reset the seed if the base learner is not a contextual bandit learner, as this breaks the exploration.
-      msrand48(seed * 2147483647);
+    uint64_t local_seed = seed * 2147483647;
+    if(reset_seed && global_seed) //reset_seed is false for contextual bandit, so that we only reset the seed if the base learner is not a contextual bandit learner, as this breaks the exploration.
+      msrand48(local_seed);
 
     if (beta >= 1) {
       if (allow_current_policy) return (int)current_policy;
@@ -91,7 +95,7 @@ namespace Searn
     } else if (num_valid_policies == 1) {
       pid = 0;
     } else {
-      float r = frand48();
+      float r = (reset_seed && !global_seed) ? merand48(local_seed) : frand48(); // rollout workers can't share the global seed
       pid = 0;
     
       if (r > beta) {
@@ -289,7 +293,7 @@ namespace Searn
   int choose_policy(searn& srn, bool allow_current, bool allow_optimal)
   {
     uint32_t seed = /* srn.read_example_last_id * 2147483 + */ (uint32_t)(srn.t * 2147483647);
-    return random_policy(seed, srn.beta, allow_current, srn.current_policy, allow_optimal, srn.rollout_all_actions);
+    return random_policy(seed, srn.beta, allow_current, srn.current_policy, allow_optimal, srn.rollout_all_actions, !srn.is_worker);
   }
 
   size_t get_all_labels(void*dst, searn& srn, size_t num_ec, v_array<uint32_t> *yallowed)
@@ -367,10 +371,9 @@ namespace Searn
     return 0;
   }
 
-  uint32_t single_prediction_LDF(vw& all, learner& base, example* ecs, size_t num_ec, COST_SENSITIVE::label* valid_labels, size_t pol, bool allow_exploration)
+  uint32_t single_prediction_LDF(vw& all, searn* srn, learner& base, example* ecs, size_t num_ec, COST_SENSITIVE::label* valid_labels, size_t pol, bool allow_exploration)
   {
     assert(pol >= 0);
-    searn *srn = (searn*)all.searnstr;
     COST_SENSITIVE::label test_label;
     COST_SENSITIVE::default_label(&test_label);
     
@@ -449,14 +452,107 @@ namespace Searn
     return ld->costs[0].action;
   }
 
-  uint32_t single_prediction_notLDF(vw& all, searn& srn, learner& base, example& ec, void*valid_labels, uint32_t pol, bool allow_exploration)
+  // the history features are the only ones that depend on the actions taken
+  // so far, so when csoaa sits right on gd we score each example once per
+  // policy without them and add just their weights for every prediction
+  void init_history_free_scores(searn& srn)
+  {
+    static_scores& c = srn.history_free;
+    COST_SENSITIVE::default_label(&c.all_actions);
+    for (uint32_t a=1; a<=srn.A; a++) {
+      COST_SENSITIVE::wclass w = { FLT_MAX, a, 0., 0. };
+      c.all_actions.costs.push_back(w);
+    }
+  }
+
+  void free_history_free_scores(searn& srn)
+  {
+    static_scores& c = srn.history_free;
+    c.all_actions.costs.delete_v();
+    c.stamps.delete_v();
+    c.scores.delete_v();
+  }
+
+  void reset_history_free_scores(searn& srn, example** ec, size_t len)
+  {
+    static_scores& c = srn.history_free;
+    if (!c.enabled) return;
+    c.sequence_stamp = c.learn_stamp = ++c.stamp;
+    c.len = 0;
+    for (size_t i=0; i<len; i++)
+      if (ec[i]->example_counter != ec[0]->example_counter + i)
+        return;  // we find examples by their counter
+    c.first_example = (len == 0) ? 0 : ec[0]->example_counter;
+    c.len = len;
+    c.policies = srn.current_policy + 1;
+    size_t n = c.len * c.policies;
+    if ((size_t)(c.stamps.end_array - c.stamps.begin) < n)
+      c.stamps.resize(n, true);  // stamps start at 1, so 0 is never valid
+    if ((size_t)(c.scores.end_array - c.scores.begin) < n * srn.A)
+      c.scores.resize(n * srn.A);
+  }
+
+  void learned_history_free_scores(searn& srn)
+  {
+    static_scores& c = srn.history_free;
+    if (c.enabled) c.learn_stamp = ++c.stamp;
+  }
+
+  // NULL if ec isn't one of the current sequence
+  float* history_free_scores(searn& srn, learner& base, example& ec, uint32_t pol)
+  {
+    static_scores& c = srn.history_free;
+    size_t i = ec.example_counter - c.first_example;
+    if ((i >= c.len) || (pol >= c.policies)) return NULL;
+
+    size_t slot = i * c.policies + pol;
+    size_t stamp = (pol == srn.current_policy) ? c.learn_stamp : c.sequence_stamp;
+    float* scores = c.scores.begin + slot * srn.A;
+    if (c.stamps[slot] != stamp) {
+      void* old_label = ec.ld;
+      ec.ld = &c.all_actions;
+      base.predict(ec, pol);
+      ec.ld = old_label;
+      for (size_t a=0; a<srn.A; a++)
+        scores[a] = c.all_actions.costs[a].partial_prediction;
+      c.stamps[slot] = stamp;
+    }
+    return scores;
+  }
+
+  // what csoaa predicts for ec, history features included, from its history-free scores
+  void predict_from_history_free(vw& all, learner& base, example& ec, uint32_t pol, float* scores)
+  {
+    COST_SENSITIVE::label* ld = (COST_SENSITIVE::label*)ec.ld;
+    feature* begin = ec.atomics[history_namespace].begin;
+    feature* end   = ec.atomics[history_namespace].end;
+    uint32_t offset = ec.ft_offset + (uint32_t)(base.increment * pol);
+    uint32_t prediction = 1;
+    float score = FLT_MAX;
+    for (COST_SENSITIVE::wclass* cl = ld->costs.begin; cl != ld->costs.end; ++cl) {
+      float p = scores[cl->weight_index - 1];
+      GD::foreach_feature<float, vec_add>(all.reg.weight_vector, all.reg.weight_mask, begin, end, p,
+                                          offset + (uint32_t)(all.reg.stride * (cl->weight_index - 1)));
+      cl->partial_prediction = p;
+      if ((p < score) || ((p == score) && (cl->weight_index < prediction))) {
+        score = p;
+        prediction = cl->weight_index;
+      }
+    }
+    ec.final_prediction = (float)prediction;
+  }
+
+  uint32_t single_prediction_notLDF(vw& all, searn& srn, learner& base, example& ec, void*valid_labels, uint32_t pol, bool allow_exploration, float* history_free=NULL)
   {
     assert(pol >= 0);
 
     void* old_label = ec.ld;
     ec.ld = valid_labels;
 
-    base.predict(ec, pol);
+    if (history_free == NULL)
+      base.predict(ec, pol);
+    else
+      predict_from_history_free(all, base, ec, pol, history_free);
     srn.total_predictions_made++;
     srn.num_features += ec.num_features;
     uint32_t final_prediction = (uint32_t)ec.final_prediction;
@@ -506,8 +602,9 @@ namespace Searn
       if (!srn.is_ldf) {  // single example
         if (srn.hinfo.length>0) {cdbg << "add_history_to_example: srn.t=" << srn.t << " h=" << srn.rollout_action.begin[srn.t] << endl;}
         if (srn.hinfo.length>0) {cdbg << "  rollout_action = ["; for (size_t i=0; i<srn.t+1; i++) cdbg << " " << srn.rollout_action.begin[i]; cdbg << " ], len=" << srn.rollout_action.size() << endl;}
+        float* history_free = srn.history_free.enabled ? history_free_scores(srn, base, *ecs, (uint32_t)pol) : NULL;
         if (srn.auto_history) add_history_to_example(all, srn.hinfo, ecs, srn.rollout_action.begin+srn.t);
-        size_t action = single_prediction_notLDF(all, srn, base, *ecs, valid_labels, pol, allow_exploration);
+        size_t action = single_prediction_notLDF(all, srn, base, *ecs, valid_labels, pol, allow_exploration, history_free);
         if (srn.auto_history) remove_history_from_example(all, srn.hinfo, ecs);
         return (uint32_t)action;
       } else {
@@ -517,7 +614,7 @@ namespace Searn
             add_history_to_example(all, srn.hinfo, &ecs[a], srn.rollout_action.begin+srn.t, a * history_constant);
           }
                                    //((OAA::mc_label*)ecs[a].ld)->label);
-        size_t action = single_prediction_LDF(all, base, ecs, num_ec, (COST_SENSITIVE::label*)valid_labels, pol, allow_exploration);
+        size_t action = single_prediction_LDF(all, &srn, base, ecs, num_ec, (COST_SENSITIVE::label*)valid_labels, pol, allow_exploration);
         if (srn.auto_history)
           for (size_t a=0; a<num_ec; a++)
             remove_history_from_example(all, srn.hinfo, &ecs[a]);
@@ -530,12 +627,21 @@ namespace Searn
   void clear_snapshot(vw& all, searn& srn, bool free_data)
   {
     /*UNDOME*/cdbg << "clear_snapshot free_data=" << free_data << endl;
-    if (free_data)
-      for (size_t i=0; i<srn.snapshot_data.size(); i++)
-        free(srn.snapshot_data[i].data_ptr);
+    if (free_data) // drops the data of every snapshot, including the beam's
+      srn.snapshot_arena.erase();
     srn.snapshot_data.erase();
   }
 
+  // copies a snapshot's data to the end of the arena
+  snapshot_item new_snapshot(searn& srn, size_t index, size_t tag, void* data_ptr, size_t sizeof_data)
+  {
+    snapshot_item item = { index, tag, srn.snapshot_arena.size(), sizeof_data, srn.t };
+    push_many(srn.snapshot_arena, (char*)data_ptr, sizeof_data);
+    return item;
+  }
+
+  inline void* snapshot_ptr(searn& srn, snapshot_item& item) { return srn.snapshot_arena.begin + item.data_offset; }
+
   void* copy_labels(searn &srn, void* l) {
     if (srn.rollout_all_actions) {
       COST_SENSITIVE::label *ret = new COST_SENSITIVE::label();
@@ -589,9 +695,10 @@ namespace Searn
   //   ystar:
   //     == NULL (or empty) means we don't know the oracle label
   //     otherwise          means the oracle could do any of the listed actions
-  uint32_t searn_predict_without_loss(vw& all, learner& base, example* ecs, size_t num_ec, v_array<uint32_t> *yallowed, v_array<uint32_t> *ystar, bool ystar_is_uint32t)  // num_ec == 0 means normal example, >0 means ldf, yallowed==NULL means all allowed, ystar==NULL means don't know; ystar_is_uint32t means that the ystar ref is really just a uint32_t
+  uint32_t searn_predict_without_loss(searn& s, learner& base, example* ecs, size_t num_ec, v_array<uint32_t> *yallowed, v_array<uint32_t> *ystar, bool ystar_is_uint32t)  // num_ec == 0 means normal example, >0 means ldf, yallowed==NULL means all allowed, ystar==NULL means don't know; ystar_is_uint32t means that the ystar ref is really just a uint32_t
   {
-    searn* srn=(searn*)all.searnstr;
+    vw& all = *s.all;
+    searn* srn=&s;
 
     // check ldf sanity
     if (!srn->is_ldf) {
@@ -761,9 +868,9 @@ namespace Searn
     }
   }
 
-  void searn_declare_loss(vw& all, size_t predictions_since_last, float incr_loss)
+  void searn_declare_loss(searn& s, size_t predictions_since_last, float incr_loss)
   {
-    searn* srn=(searn*)all.searnstr;
+    searn* srn=&s;
 
     if ((srn->beam_size == 0) && (srn->t != srn->loss_last_step + predictions_since_last)) {
       cerr << "fail: searntask hasn't counted its predictions correctly.  current time step=" << srn->t << ", last declaration at " << srn->loss_last_step << ", declared # of predictions since then is " << predictions_since_last << endl;
@@ -789,10 +896,10 @@ namespace Searn
   }
 
 
-  uint32_t searn_predict(vw& all, learner& base, example* ecs, size_t num_ec, v_array<uint32_t> *yallowed, v_array<uint32_t> *ystar, bool ystar_is_uint32t)  // num_ec == 0 means normal example, >0 means ldf, yallowed==NULL means all allowed, ystar==NULL means don't know; ystar_is_uint32t means that the ystar ref is really just a uint32_t
+  uint32_t searn_predict(searn& s, learner& base, example* ecs, size_t num_ec, v_array<uint32_t> *yallowed, v_array<uint32_t> *ystar, bool ystar_is_uint32t)  // num_ec == 0 means normal example, >0 means ldf, yallowed==NULL means all allowed, ystar==NULL means don't know; ystar_is_uint32t means that the ystar ref is really just a uint32_t
   {
-    searn* srn=(searn*)all.searnstr;
-    uint32_t a = searn_predict_without_loss(all, base, ecs, num_ec, yallowed, ystar, ystar_is_uint32t);
+    searn* srn=&s;
+    uint32_t a = searn_predict_without_loss(s, base, ecs, num_ec, yallowed, ystar, ystar_is_uint32t);
 
     if (srn->auto_hamming_loss) {
       float this_loss = 0.;
@@ -805,79 +912,66 @@ namespace Searn
             (!v_array_contains(*ystar, a)))
           this_loss = 1.;
       }
-      searn_declare_loss(all, 1, this_loss);
+      searn_declare_loss(s, 1, this_loss);
     }
 
     return a;
   } 
       
 
-  bool snapshot_binary_search_lt(v_array<snapshot_item> a, size_t desired_t, size_t tag, size_t &pos, size_t last_found_pos) {
-    size_t hi  = a.size();
-    if (hi == 0) return false;
-    if (last_found_pos + 1 < hi) {
-      pos = last_found_pos+1;
-      if ((a[pos].pred_step == desired_t) && (a[pos].tag == tag)) return true;
-      if (pos == hi - 1) { // this is the last item
-        if ((a[pos].pred_step < desired_t) && (a[pos].tag == tag)) return true;
-        else return false;
+  // snapshots are recorded in order of index (then tag), and of pred_step
+  inline bool index_before(snapshot_item& a, size_t index, size_t tag) { return (a.index < index) || ((a.index == index) && (a.tag < tag)); }
+  inline bool step_not_after(snapshot_item& a, size_t t, size_t tag) { return a.pred_step <= t; }
+
+  // the first position whose item is not before the key.  rollouts look
+  // snapshots up in order, so this gallops away from hint (the position
+  // after the last one found) in steps of 1, 2, 4, ... and then bisects the
+  // last step, which is O(log d) for an answer d items away from it.
+  template<bool (*before)(snapshot_item&, size_t, size_t)>
+  size_t snapshot_gallop(v_array<snapshot_item>& a, size_t key, size_t tag, size_t hint)
+  {
+    size_t n  = a.size();
+    size_t lo = 0;  // everything before lo is before the key
+    size_t hi = n;  // nothing from hi on is
+    if (hint > n) hint = n;
+
+    if ((hint < n) && before(a[hint], key, tag)) {
+      lo = hint + 1;
+      for (size_t step = 1; hint + step < n; step *= 2) {
+        if (! before(a[hint + step], key, tag)) { hi = hint + step; break; }
+        lo = hint + step + 1;
+      }
+    } else {
+      hi = hint;
+      for (size_t step = 1; step <= hint; step *= 2) {
+        if (before(a[hint - step], key, tag)) { lo = hint - step + 1; break; }
+        hi = hint - step;
       }
-      // not the last item
-      if ((a[pos].pred_step <= desired_t) && (a[pos].tag == tag) &&
-          ((a[pos+1].pred_step >  desired_t) ||
-           ((a[pos+1].pred_step == desired_t) && (a[pos+1].tag > tag))))
-        return true;
-    }
-    pos = hi >> 1;
-    while (true) {
-      if (hi <= 5) break;
-      if ((a[pos].pred_step == desired_t) && (a[pos].tag == tag)) return true;
-      if ((a[pos].pred_step >  desired_t) ||
-          ((a[pos].pred_step == desired_t) && (a[pos].tag >  tag)))
-        hi = pos;
-      else break;
-      
-      pos = hi >> 1;
     }
 
-    for (pos=hi-1; ; pos--) {
-      if ((a[pos].pred_step <= desired_t) && (tag == a[pos].tag)) return true;
-      if (pos == 0) return false;
+    while (lo < hi) {
+      size_t mid = (lo + hi) >> 1;
+      if (before(a[mid], key, tag)) lo = mid + 1;
+      else                          hi = mid;
     }
-    return false;
+    return lo;
   }
 
-
-  bool snapshot_binary_search_eq(v_array<snapshot_item> a, size_t desired_index, size_t tag, size_t &pos, size_t last_found_pos) {
-    size_t lo  = 0;  // the answer is always >= lo
-    size_t hi  = a.size();  // the answer is always < hi
-    if (hi == 0) return false;
-
-    if (last_found_pos + 1 < hi) {
-      pos = last_found_pos+1;
-      if ((a[pos].index == desired_index) && (a[pos].tag == tag)) return true;
-    } else      
-      pos = (lo + hi) >> 1;
-    while (true) {
-      if (lo == hi) return false;
-      if ((a[pos].index == desired_index) && (a[pos].tag == tag)) return true;
-      if (hi - lo <= 5) break;
-      if ((a[pos].index <  desired_index) ||
-          ((a[pos].index == desired_index) && (a[pos].tag <  tag)))
-        lo = pos;
-      else
-        hi = pos;
-      pos = (lo + hi) >> 1;
-    }
-
-    for (pos=lo; pos<hi; pos++) {
-      if (a[pos].index > desired_index) return false;
-      if ((a[pos].index == desired_index) && (a[pos].tag == tag)) return true;
-    }
+  // the last snapshot with the given tag made at or before desired_t
+  bool snapshot_search_lt(v_array<snapshot_item>& a, size_t desired_t, size_t tag, size_t &pos, size_t last_found_pos) {
+    for (size_t end = snapshot_gallop<step_not_after>(a, desired_t, tag, last_found_pos + 1); end > 0; end--)
+      if (a[end-1].tag == tag) {
+        pos = end-1;
+        return true;
+      }
     return false;
   }
 
-  
+  // the snapshot with the given index and tag
+  bool snapshot_search_eq(v_array<snapshot_item>& a, size_t desired_index, size_t tag, size_t &pos, size_t last_found_pos) {
+    pos = snapshot_gallop<index_before>(a, desired_index, tag, last_found_pos + 1);
+    return (pos < a.size()) && (a[pos].index == desired_index) && (a[pos].tag == tag);
+  }
 
   void searn_snapshot_data(vw& all, searn*srn, size_t index, size_t tag, void* data_ptr, size_t sizeof_data, bool used_for_prediction)
   {
@@ -893,10 +987,7 @@ namespace Searn
            ((srn->snapshot_data.last().index == index) && (srn->snapshot_data.last().tag > tag)))) 
         cerr << "warning: trying to snapshot in a non-monotonic order! ignoring this snapshot" << endl;
       else {
-        void* new_data = malloc(sizeof_data);
-        memcpy(new_data, data_ptr, sizeof_data);
-        snapshot_item item = { index, tag, new_data, sizeof_data, srn->t };
-        srn->snapshot_data.push_back(item);
+        srn->snapshot_data.push_back(new_snapshot(*srn, index, tag, data_ptr, sizeof_data));
       }
       return;
     } else if (srn->state == LEARN) {
@@ -904,7 +995,7 @@ namespace Searn
         // otherwise, we're restoring snapshots -- we want to find the index of largest value that has .t<=learn_t
         size_t i;
         bool found;
-        found = snapshot_binary_search_lt(srn->snapshot_data, srn->learn_t, tag, i, srn->snapshot_last_found_pos);
+        found = snapshot_search_lt(srn->snapshot_data, srn->learn_t, tag, i, srn->snapshot_last_found_pos);
         if (!found) return;  // can't do anything
 
         if (tag == 1)
@@ -915,19 +1006,19 @@ namespace Searn
 
         assert(sizeof_data == item.data_size);
 
-        memcpy(data_ptr, item.data_ptr, sizeof_data);
+        memcpy(data_ptr, snapshot_ptr(*srn, item), sizeof_data);
         srn->t = item.pred_step;
       } else if (srn->do_fastforward) { // can we FAST FORWARD to end???
         if (srn->rollout_oracle) return;
         if (! srn->snapshot_could_match) return; // already hosed
         if (! used_for_prediction) return; // we don't care if it matches or not
         size_t i;
-        bool found = snapshot_binary_search_eq(srn->snapshot_data, index, tag, i, srn->snapshot_last_found_pos);
+        bool found = snapshot_search_eq(srn->snapshot_data, index, tag, i, srn->snapshot_last_found_pos);
         if (!found) return; // can't do anything -- TODO is this right?
       
         srn->snapshot_last_found_pos = i;
         snapshot_item item = srn->snapshot_data[i];
-        bool matches = memcmp(item.data_ptr, data_ptr, sizeof_data) == 0;
+        bool matches = memcmp(snapshot_ptr(*srn, item), data_ptr, sizeof_data) == 0;
         if (matches) {
           // TODO: make sure it's the right number of snapshots!!!
           srn->snapshot_is_equivalent_to_t = item.pred_step;
@@ -941,10 +1032,7 @@ namespace Searn
           (srn->snapshot_data[cur_size - 1].pred_step < srn->t))
         clear_snapshot(all, *srn, true);
       
-      void* new_data = malloc(sizeof_data);
-      memcpy(new_data, data_ptr, sizeof_data);
-      snapshot_item item = { index, tag, new_data, sizeof_data, srn->t };
-      srn->snapshot_data.push_back(item);
+      srn->snapshot_data.push_back(new_snapshot(*srn, index, tag, data_ptr, sizeof_data));
     } else if (srn->state == BEAM_ADVANCE) {
       /*UNDOME*/cdbg << "snapshot(BEAM_ADVANCE), srn.t=" << srn->t << ", hyp.t=" << srn->cur_beam_hyp->t << " { cur_beam_hyp=" << srn->cur_beam_hyp << ", parent=" << srn->cur_beam_hyp->parent << " }" << endl;
       assert(srn->cur_beam_hyp->parent != NULL);
@@ -956,23 +1044,20 @@ namespace Searn
           /*UNDOME*/cdbg << "skipping to desired position" << endl;
           assert(srn->cur_beam_hyp->parent->snapshot.size() > 0);
           size_t i, desired_index = srn->cur_beam_hyp->parent->snapshot[0].index;
-          bool found = snapshot_binary_search_eq(srn->cur_beam_hyp->parent->snapshot, desired_index, tag, i, srn->snapshot_last_found_pos);
+          bool found = snapshot_search_eq(srn->cur_beam_hyp->parent->snapshot, desired_index, tag, i, srn->snapshot_last_found_pos);
           if (! found) {
             cerr << "beam search failed (snapshot not found)" << endl;
             throw exception();
           }
 
           assert(sizeof_data == srn->cur_beam_hyp->parent->snapshot[i].data_size);
-          memcpy(data_ptr, srn->cur_beam_hyp->parent->snapshot[i].data_ptr, sizeof_data);
+          memcpy(data_ptr, snapshot_ptr(*srn, srn->cur_beam_hyp->parent->snapshot[i]), sizeof_data);
           srn->t = srn->cur_beam_hyp->parent->snapshot[i].pred_step;
           cdbg << "  set data_ptr to " << *(uint32_t*)data_ptr << ", and srn->t to " << srn->t << " { cur_beam_hyp=" << srn->cur_beam_hyp << ", parent=" << srn->cur_beam_hyp->parent << " }" << endl;
         }
       } else if (srn->t == srn->cur_beam_hyp->t) {
         /*UNDOME*/cdbg << "recording index=" << index << " tag=" << tag << " data_ptr=" << *(uint32_t*)data_ptr << " { cur_beam_hyp=" << srn->cur_beam_hyp << ", parent=" << srn->cur_beam_hyp->parent << " }" << endl;
-        void* new_data = malloc(sizeof_data);
-        memcpy(new_data, data_ptr, sizeof_data);
-        snapshot_item item = { index, tag, new_data, sizeof_data, srn->t };
-        srn->cur_beam_hyp->snapshot.push_back(item);
+        srn->cur_beam_hyp->snapshot.push_back(new_snapshot(*srn, index, tag, data_ptr, sizeof_data));
         srn->cur_beam_hyp->filled_in_snapshot = true;
       } else {
         /*UNDOME*/cdbg << "fast forward to end" << endl;
@@ -980,14 +1065,14 @@ namespace Searn
         size_t i;
         assert(srn->beam_restore_to_end.size() > 0);
         size_t end_index = srn->beam_restore_to_end[0].index;
-        bool found = snapshot_binary_search_eq(srn->beam_restore_to_end, end_index, tag, i, srn->snapshot_last_found_pos);
+        bool found = snapshot_search_eq(srn->beam_restore_to_end, end_index, tag, i, srn->snapshot_last_found_pos);
         if (! found) {
           cerr << "beam search failed (fast-forward not found)" << endl;
           throw exception();
         }
 
         assert(sizeof_data == srn->beam_restore_to_end[i].data_size);
-        memcpy(data_ptr, srn->beam_restore_to_end[i].data_ptr, sizeof_data);
+        memcpy(data_ptr, snapshot_ptr(*srn, srn->beam_restore_to_end[i]), sizeof_data);
         srn->t = srn->beam_restore_to_end[i].pred_step;
       }
     } else if (srn->state == BEAM_PLAYOUT) {
@@ -999,8 +1084,9 @@ namespace Searn
   }
 
 
-  void searn_snapshot(vw& all, size_t index, size_t tag, void* data_ptr, size_t sizeof_data, bool used_for_prediction) {
-    searn* srn=(searn*)all.searnstr;
+  void searn_snapshot(searn& s, size_t index, size_t tag, void* data_ptr, size_t sizeof_data, bool used_for_prediction) {
+    vw& all = *s.all;
+    searn* srn=&s;
     assert(tag >= 1);
     if (sizeof_data == 0) return;
 
@@ -1121,6 +1207,7 @@ namespace Searn
       if (srn.auto_history) add_history_to_example(all, srn.hinfo, ec, srn.rollout_action.begin+srn.learn_t);
       ec[0].in_use = true;
       base.learn(ec[0], srn.current_policy);
+      learned_history_free_scores(srn);
       if (srn.auto_history) remove_history_from_example(all, srn.hinfo, ec);
       ec[0].ld = old_label;
       srn.total_examples_generated++;
@@ -1177,13 +1264,29 @@ namespace Searn
   }
 
 
+  void free_beam_hyp(beam_hyp& hyp) { hyp.snapshot.delete_v(); }
+
   void beam_predict(vw&all, searn&srn, example**ec, size_t len) {
     using namespace Beam;
     uint32_t DEFAULT_HASH = 0;
 
-    v_array<beam_hyp> hyp_pool;
-    size_t hyp_pool_id = 0;
-    hyp_pool.resize(10000, true);
+    clear_snapshot(all, srn, true);  // nothing from the last sequence is needed
+    reset_history_free_scores(srn, ec, len);
+
+    if ((srn.beam_size == 1) && (srn.kbest <= 1)) {
+      // a beam of one keeps the cheapest action at every step, which is what
+      // a test pass does without replaying the sequence for every action
+      reset_searn_structure(srn);
+      srn.state = INIT_TEST;
+      srn.truth_string->str("");
+      srn.pred_string->str("");
+      srn.task->structured_predict(srn, ec, len, srn.pred_string, srn.truth_string);
+      for (int* sink = all.final_prediction_sink.begin; sink != all.final_prediction_sink.end; ++sink)
+        all.print_text(*sink, srn.pred_string->str(), ec[0]->tag);
+      if ((all.raw_prediction > 0) && (srn.rollout_all_actions))
+        all.print_text(all.raw_prediction, "", ec[0]->tag);
+      return;
+    }
 
     beam* cur_beam   = new beam(srn.beam_size);
     beam* next_beam  = new beam(srn.beam_size);
@@ -1195,7 +1298,7 @@ namespace Searn
       //   1) collect the number of actions & corresponding costs available at time 0
       //   2) collect the initial snapshot
       //   3) store the final snapshot so we can fast-foward to the end at will
-      beam_hyp *hyp = hyp_pool.begin;
+      beam_hyp *hyp = srn.beam_hyps->get();
     
       hyp->t            = 0;
       hyp->parent       = NULL;
@@ -1219,7 +1322,7 @@ namespace Searn
         v_array<COST_SENSITIVE::wclass>* costs = &((COST_SENSITIVE::label*)srn.valid_labels)->costs;
         assert(hyp->num_actions == costs->size());
         cdbg << "action_costs =";
-        hyp->action_costs = (float*)calloc(hyp->num_actions, sizeof(float));
+        hyp->action_costs = srn.beam_costs->get(hyp->num_actions);
         for (size_t i=0; i<hyp->num_actions; i++) {
           hyp->action_costs[i] = (costs->begin+i)->partial_prediction;
           cdbg << " " << hyp->action_costs[i];
@@ -1240,11 +1343,7 @@ namespace Searn
         beam_hyp* hyp = (beam_hyp*) be->data;
         for (size_t a=0; a<hyp->num_actions; a++) {
           /*UNDOME*/cdbg << "expanding hyp @ " << hyp << " { t=" << hyp->t << ", action_taken=" << hyp->action_taken << ", parent=" << hyp->parent << " a=" << a << "/" << hyp->num_actions << " }" << endl;
-          if (hyp_pool.begin + hyp_pool_id + 1 >= hyp_pool.end_array) {
-            assert(false);
-            hyp_pool.resize(hyp_pool_id * 2 + 1, true);
-          }
-          beam_hyp *next = hyp_pool.begin + (++hyp_pool_id);
+          beam_hyp *next = srn.beam_hyps->get();
           next->t            = hyp->t + 1; // TODO: make this more flexible
           next->parent       = hyp;
           next->incr_cost    = hyp->action_costs[a];
@@ -1268,7 +1367,7 @@ namespace Searn
             if (srn.rollout_all_actions) { // TODO: handle CB
               v_array<COST_SENSITIVE::wclass>* costs = &((COST_SENSITIVE::label*)srn.valid_labels)->costs;
               assert(next->num_actions == costs->size());
-              next->action_costs = (float*)calloc(next->num_actions, sizeof(float));
+              next->action_costs = srn.beam_costs->get(next->num_actions);
               for (size_t i=0; i<next->num_actions; i++)
                 next->action_costs[i] = (costs->begin+i)->partial_prediction;
             }
@@ -1358,17 +1457,9 @@ namespace Searn
           all.print_text(*sink, "", ec[0]->tag);
     }
 
-    
-    for (size_t i=0; i<hyp_pool_id; i++) {
-      if (hyp_pool[i].action_costs)
-        free(hyp_pool[i].action_costs);
-      for (size_t j=0; j<hyp_pool[i].snapshot.size(); j++)
-        if (hyp_pool[i].snapshot[j].data_ptr)
-          free(hyp_pool[i].snapshot[j].data_ptr);
-      hyp_pool[i].snapshot.delete_v();
-    }
 
-    hyp_pool.delete_v();
+    srn.beam_hyps->reset();
+    srn.beam_costs->reset();
   
     cur_beam->erase();
     next_beam->erase();
@@ -1378,6 +1469,295 @@ namespace Searn
     delete final_beam;
   }
 
+  // what the history features after prev add to the score of each action of
+  // ec; the one of action a goes to scores[a*stride]
+  void history_scores(vw& all, searn& srn, learner& base, example& ec, uint32_t pol, uint32_t prev, float* scores, size_t stride)
+  {
+    add_history_to_example(all, srn.hinfo, &ec, &prev);
+    feature* begin = ec.atomics[history_namespace].begin;
+    feature* end   = ec.atomics[history_namespace].end;
+    uint32_t offset = ec.ft_offset + (uint32_t)(base.increment * pol);
+    for (size_t a=0; a<srn.A; a++) {
+      float s = 0.;
+      GD::foreach_feature<float, vec_add>(all.reg.weight_vector, all.reg.weight_mask, begin, end, s,
+                                          offset + (uint32_t)(all.reg.stride * a));
+      scores[a*stride] = s;
+    }
+    remove_history_from_example(all, srn.hinfo, &ec);
+  }
+
+  template<class T> void reserve(v_array<T>& v, size_t n)
+  {
+    if ((size_t)(v.end_array - v.begin) < n)
+      v.resize(n);
+  }
+
+  // with one action of history, the score of an action depends on just the
+  // example and the previous action, so the cheapest sequence under the
+  // summed scores (what an unbounded beam finds) comes from dynamic
+  // programming over an A x A lattice per example: its history-free scores
+  // plus the history weights after each previous action.  false if the
+  // sequence can't be decoded this way
+  bool viterbi_predict(vw& all, searn& srn, example** ec, size_t len)
+  {
+    learner& base = *srn.base_learner;
+    viterbi_lattice& v = srn.lattice;
+    size_t A = srn.A;
+
+    reset_searn_structure(srn);
+    reset_history_free_scores(srn, ec, len);
+    if (srn.history_free.len != len) return false;
+
+    reserve(v.cost, A);
+    reserve(v.next_cost, A);
+    reserve(v.transition, A * A);
+    reserve(v.through, A);
+    reserve(v.back, len * A);
+    float* cost = v.cost.begin;
+    float* next = v.next_cost.begin;
+    float* through = v.through.begin;
+
+    for (size_t i=0; i<len; i++) {
+      srn.t = i;  // the policy is chosen by time step, as for greedy prediction
+      uint32_t pol = (uint32_t)choose_policy(srn, true, false);
+      float* scores = history_free_scores(srn, base, *ec[i], pol);
+      uint32_t* back = v.back.begin + i * A;
+      if (i == 0) {
+        history_scores(all, srn, base, *ec[0], pol, 0, next, 1);
+        for (size_t a=0; a<A; a++) {
+          next[a] += scores[a];
+          back[a] = 0;
+        }
+      } else {
+        for (uint32_t prev=1; prev<=A; prev++)
+          history_scores(all, srn, base, *ec[i], pol, prev, v.transition.begin + (prev-1), A);
+        for (size_t a=0; a<A; a++) {
+          float* transition = v.transition.begin + a * A;
+          for (size_t p=0; p<A; p++)
+            through[p] = cost[p] + transition[p];
+          float best = through[0];
+          for (size_t p=1; p<A; p++)
+            best = (through[p] < best) ? through[p] : best;
+          size_t p = 0;
+          while (through[p] != best) p++;  // ties go to the lowest previous action
+          next[a] = best + scores[a];
+          back[a] = (uint32_t)(p + 1);
+        }
+      }
+      float* temp = cost;
+      cost = next;
+      next = temp;
+      srn.num_features += ec[i]->num_features;
+    }
+
+    size_t a = 0;
+    for (size_t b=1; b<A; b++)
+      if (cost[b] < cost[a]) a = b;
+
+    // play the path back through the task for its output and loss
+    srn.beam_final_action_sequence.erase();
+    for (size_t i=len; i>0; i--) {
+      srn.beam_final_action_sequence.push_back((uint32_t)a);
+      a = v.back[(i-1) * A + a] - 1;
+    }
+    size_t num_features = srn.num_features;
+    reset_searn_structure(srn);
+    srn.num_features = num_features;
+    srn.total_predictions_made += len;
+    srn.state = BEAM_PLAYOUT;
+    srn.truth_string->str("");
+    srn.pred_string->str("");
+    srn.task->structured_predict(srn, ec, len, srn.pred_string, srn.truth_string);
+
+    for (int* sink = all.final_prediction_sink.begin; sink != all.final_prediction_sink.end; ++sink)
+      all.print_text((int)*sink, srn.pred_string->str(), ec[0]->tag);
+    return true;
+  }
+
+  // a worker rolls out some of the (timestep, action) pairs of an example
+  // with its own copy of the searn state, and of the examples, since
+  // predicting adds history features to them
+  struct rollout_worker {
+    searn* srn;
+    searn* main;
+    example** ec;               // the sequence being learned
+    size_t len;
+    example* ec_copy;           // the worker's copy of it
+    size_t ec_capacity;
+    v_array<example*> ec_ptrs;  // what the task gets handed
+    size_t id;
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+  };
+
+  // copies in what rollouts read but don't write; the arrays stay shared
+  void sync_worker(searn& w, searn& srn)
+  {
+    w.all                     = srn.all;
+    w.base_learner            = srn.base_learner;
+    w.task                    = srn.task;
+    w.task_data               = srn.task_data;
+    w.auto_history            = srn.auto_history;
+    w.auto_hamming_loss       = srn.auto_hamming_loss;
+    w.examples_dont_change    = srn.examples_dont_change;
+    w.is_ldf                  = srn.is_ldf;
+    w.predict_f               = srn.predict_f;
+    w.declare_loss_f          = srn.declare_loss_f;
+    w.snapshot_f              = srn.snapshot_f;
+    w.A                       = srn.A;
+    w.state                   = srn.state;
+    w.hinfo                   = srn.hinfo;
+    w.beta                    = srn.beta;
+    w.allow_current_policy    = srn.allow_current_policy;
+    w.rollout_oracle          = srn.rollout_oracle;
+    w.rollout_all_actions     = srn.rollout_all_actions;
+    w.current_policy          = srn.current_policy;
+    w.exploration_temperature = srn.exploration_temperature;
+    w.beam_size               = srn.beam_size;
+    w.do_snapshot             = srn.do_snapshot;
+    w.do_fastforward          = srn.do_fastforward;
+    w.T                       = srn.T;
+    w.train_loss              = srn.train_loss;
+    w.snapshot_data           = srn.snapshot_data;
+    w.snapshot_arena          = srn.snapshot_arena;
+    w.train_action            = srn.train_action;
+    w.train_action_ids        = srn.train_action_ids;
+    w.train_labels            = srn.train_labels;
+    w.empty_example           = srn.empty_example;
+    w.history_free.enabled    = srn.history_free.enabled;
+    w.num_features            = 0;
+    w.total_predictions_made  = 0;
+  }
+
+  void free_sequence_copy(rollout_worker& w)
+  {
+    for (size_t i=0; i<w.ec_capacity; i++)
+      dealloc_example(MULTICLASS::delete_label, w.ec_copy[i]);
+    free(w.ec_copy);
+    w.ec_copy = NULL;
+    w.ec_capacity = 0;
+  }
+
+  void copy_sequence(rollout_worker& w)
+  {
+    if (w.len > w.ec_capacity) {
+      free_sequence_copy(w);
+      w.ec_copy = alloc_examples(sizeof(MULTICLASS::mc_label), w.len);
+      w.ec_capacity = w.len;
+    }
+    w.ec_ptrs.erase();
+    for (size_t i=0; i<w.len; i++) {
+      VW::copy_example_data(false, &w.ec_copy[i], w.ec[i], sizeof(MULTICLASS::mc_label), NULL);
+      w.ec_ptrs.push_back(&w.ec_copy[i]);
+    }
+  }
+
+  void do_rollouts(rollout_worker& w)
+  {
+    searn& srn = *w.srn;
+    v_array<rollout>& rollouts = w.main->rollouts;
+    if (w.id >= rollouts.size()) return;
+
+    copy_sequence(w);
+    reset_history_free_scores(srn, w.ec_ptrs.begin, w.len);
+    for (size_t j=w.id; j<rollouts.size(); j+=w.main->workers.size()) {
+      rollout& r = rollouts[j];
+      if (srn.auto_history) {
+        clear_rollout_actions(srn);
+        push_many(srn.rollout_action, srn.train_action.begin, r.t);
+      }
+      srn.snapshot_last_found_pos = (size_t)-1;
+      srn.learn_t = r.t;
+      srn.t = 0;
+      srn.learn_a = r.a;
+      srn.loss_last_step = 0;
+      srn.learn_loss = 0.f;
+      srn.learn_example_len = 0;
+      srn.snapshot_is_equivalent_to_t = (size_t)-1;
+      srn.snapshot_could_match = true;
+      srn.task->structured_predict(srn, w.ec_ptrs.begin, w.len, NULL, NULL);
+
+      r.loss = srn.learn_loss;
+      r.ec_index = (srn.learn_example_len == 0) ? (size_t)-1 : (size_t)(srn.learn_example_ref - w.ec_copy);
+    }
+  }
+
+#ifdef _WIN32
+  DWORD WINAPI run_rollout_worker(LPVOID in)
+#else
+  void* run_rollout_worker(void* in)
+#endif
+  {
+    do_rollouts(*(rollout_worker*)in);
+    return 0;
+  }
+
+  // rolls out every action but the trained one at each timestep of tset,
+  // all against the weights from before any of them is learned, so the
+  // losses don't depend on the number of workers.  the first worker runs on
+  // the calling thread.
+  void run_rollouts(searn& srn, example** ec, size_t len, v_array<size_t>& tset)
+  {
+    srn.rollouts.erase();
+    for (size_t tid=0; tid<tset.size(); tid++) {
+      size_t t = tset[tid];
+      void *aset = srn.train_labels[t];
+      for (size_t i=0; i<labelset_size(srn, aset); i++) {
+        size_t this_index = labelset_weight_index(srn, aset, i);
+        if (this_index != srn.train_action_ids[t]) {
+          rollout r = { tid, t, (uint32_t)this_index, 0.f, (size_t)-1 };
+          srn.rollouts.push_back(r);
+        }
+      }
+    }
+
+    // with normalized updates, predicting rescales a weight the first time
+    // its feature shows up at a larger scale.  do that here, on this thread,
+    // for every policy the rollouts can use, so that the workers only read
+    // the weights.  (history features always have the same value, so the
+    // workers at most store that same scale again.)
+    vw& all = *srn.all;
+    if (all.normalized_updates && (srn.rollouts.size() > 0)) {
+      get_all_labels(srn.valid_labels, srn, 0, NULL);
+      uint32_t policies = srn.current_policy + (srn.allow_current_policy ? 1 : 0);
+      for (size_t i=0; i<len; i++) {
+        void* old_label = ec[i]->ld;
+        ec[i]->ld = srn.valid_labels;
+        for (uint32_t pol=0; pol<policies; pol++)
+          srn.base_learner->predict(*ec[i], pol);
+        ec[i]->ld = old_label;
+      }
+    }
+
+    for (rollout_worker** w = srn.workers.begin; w != srn.workers.end; w++) {
+      sync_worker(*(*w)->srn, srn);
+      (*w)->ec = ec;
+      (*w)->len = len;
+    }
+    for (rollout_worker** w = srn.workers.begin + 1; w < srn.workers.end; w++)
+#ifdef _WIN32
+      (*w)->thread = ::CreateThread(NULL, 0, static_cast<LPTHREAD_START_ROUTINE>(run_rollout_worker), *w, NULL, NULL);
+#else
+      pthread_create(&(*w)->thread, NULL, run_rollout_worker, *w);
+#endif
+    do_rollouts(*srn.workers[0]);
+    for (rollout_worker** w = srn.workers.begin; w != srn.workers.end; w++) {
+      if (w != srn.workers.begin) {
+#ifdef _WIN32
+        ::WaitForSingleObject((*w)->thread, INFINITE);
+        ::CloseHandle((*w)->thread);
+#else
+        pthread_join((*w)->thread, NULL);
+#endif
+      }
+      srn.num_features += (*w)->srn->num_features;
+      srn.total_predictions_made += (*w)->srn->total_predictions_made;
+    }
+  }
+
 template <bool is_learn>
 void train_single_example(vw& all, searn& srn, example**ec, size_t len)
 {
@@ -1385,6 +1765,7 @@ void train_single_example(vw& all, searn& srn, example**ec, size_t len)
   cdbg << "======================================== INIT TEST (" << srn.current_policy << "," << srn.read_example_last_pass << ") ========================================" << endl;
 
   reset_searn_structure(srn);
+  reset_history_free_scores(srn, ec, len);
   srn.state = INIT_TEST;
     
   if ((all.final_prediction_sink.size() > 0) ||   // if we have to produce output, we need to run this
@@ -1445,40 +1826,66 @@ void train_single_example(vw& all, searn& srn, example**ec, size_t len)
       cdbg << "======================================== LEARN (" << srn.current_policy << "," << srn.read_example_last_pass << ") ========================================" << endl;
       srn.state = LEARN;
       v_array<size_t> tset = get_training_timesteps(all, srn);
+      if (srn.rollout_threads > 0)
+        run_rollouts(srn, ec, len, tset);
+      rollout* r = srn.rollouts.begin;
       for (size_t tid=0; tid<tset.size(); tid++) {
         size_t t = tset[tid];
         void *aset = srn.train_labels[t];
         srn.learn_t = t;
         srn.learn_losses.erase();
 
-        for (size_t i=0; i<labelset_size(srn, aset); i++) {
+        if (srn.rollout_threads > 0) {
+          // the rollouts are done already; collect their losses in order
+          for (size_t i=0; i<labelset_size(srn, aset); i++) {
+            size_t this_index = labelset_weight_index(srn, aset, i);
+            if (this_index == srn.train_action_ids[srn.learn_t])
+              srn.learn_losses.push_back( srn.train_loss );
+            else {
+              assert((r < srn.rollouts.end) && (r->tid == tid) && (r->a == this_index));
+              srn.learn_example_len = 0;
+              if (r->ec_index != (size_t)-1) {
+                srn.learn_example_ref = ec[r->ec_index];
+                srn.learn_example_len = 1;
+              }
+              srn.learn_losses.push_back( r->loss );
+              r++;
+            }
+          }
           if (srn.auto_history) {
-            // startup the rollout at the train actions
             clear_rollout_actions(srn);
-            //srn.rollout_action.resize(srn.hinfo.length + srn.T);
             push_many(srn.rollout_action, srn.train_action.begin, t);
-            //memcpy(srn.rollout_action.begin + srn.hinfo.length, srn.train_action.begin, srn.T * sizeof(uint32_t));
           }
-          srn.snapshot_last_found_pos = (size_t)-1;
-
-          size_t this_index = labelset_weight_index(srn, aset, i);
-          assert(this_index <= srn.A);
-          if (this_index == srn.train_action_ids[srn.learn_t])
-            srn.learn_losses.push_back( srn.train_loss );
-          else {
-            srn.t = 0;
-            srn.learn_a = (uint32_t)this_index;
-            srn.loss_last_step = 0;
-            srn.learn_loss = 0.f;
-            srn.learn_example_len = 0;
+        } else {
+          for (size_t i=0; i<labelset_size(srn, aset); i++) {
+            if (srn.auto_history) {
+              // startup the rollout at the train actions
+              clear_rollout_actions(srn);
+              //srn.rollout_action.resize(srn.hinfo.length + srn.T);
+              push_many(srn.rollout_action, srn.train_action.begin, t);
+              //memcpy(srn.rollout_action.begin + srn.hinfo.length, srn.train_action.begin, srn.T * sizeof(uint32_t));
+            }
+            srn.snapshot_last_found_pos = (size_t)-1;
+
+            size_t this_index = labelset_weight_index(srn, aset, i);
+            assert(this_index <= srn.A);
+            if (this_index == srn.train_action_ids[srn.learn_t])
+              srn.learn_losses.push_back( srn.train_loss );
+            else {
+              srn.t = 0;
+              srn.learn_a = (uint32_t)this_index;
+              srn.loss_last_step = 0;
+              srn.learn_loss = 0.f;
+              srn.learn_example_len = 0;
             
-            cdbg << "learn_t = " << srn.learn_t << " || learn_a = " << srn.learn_a << endl;
-            srn.snapshot_is_equivalent_to_t = (size_t)-1;
-            srn.snapshot_could_match = true;
-            srn.task->structured_predict(srn, ec, len, NULL, NULL);
+              cdbg << "learn_t = " << srn.learn_t << " || learn_a = " << srn.learn_a << endl;
+              srn.snapshot_is_equivalent_to_t = (size_t)-1;
+              srn.snapshot_could_match = true;
+              srn.task->structured_predict(srn, ec, len, NULL, NULL);
 
-            srn.learn_losses.push_back( srn.learn_loss );
-            cdbg << "total loss: " << srn.learn_loss << endl;
+              srn.learn_losses.push_back( srn.learn_loss );
+              cdbg << "total loss: " << srn.learn_loss << endl;
+            }
           }
         }
 
@@ -1746,10 +2153,10 @@ void print_update(vw& all, searn& srn)
       return;  // nothing to do :)
 
     add_neighbor_features(srn);
-    if (srn.beam_size == 0)
-      train_single_example<is_learn>(all, srn, srn.ec_seq.begin, srn.ec_seq.size());
-    else
+    if (srn.beam_size > 0)
       beam_predict(all, srn, srn.ec_seq.begin, srn.ec_seq.size());
+    else if (!srn.viterbi || !viterbi_predict(all, srn, srn.ec_seq.begin, srn.ec_seq.size()))
+      train_single_example<is_learn>(all, srn, srn.ec_seq.begin, srn.ec_seq.size());
     del_neighbor_features(srn);
 
     if (srn.ec_seq[0]->test_only) {
@@ -1859,6 +2266,7 @@ void print_update(vw& all, searn& srn)
     srn.exploration_temperature = -1.0; // don't explore
     srn.beam_size = 0; // 0 ==> no beam
     srn.kbest = 0; // 0 or 1 means just 1 best
+    srn.viterbi = false;
     
     srn.neighbor_features_string = new string();
     
@@ -1887,10 +2295,17 @@ void print_update(vw& all, searn& srn)
     srn.auto_hamming_loss = false;
     srn.examples_dont_change = false;
     srn.is_ldf = false;
+    srn.one_prediction_per_example = false;
     
     srn.empty_example = alloc_examples(sizeof(COST_SENSITIVE::label), 1);
     COST_SENSITIVE::default_label(srn.empty_example->ld);
     srn.empty_example->in_use = true;
+
+    srn.rollout_threads = 0;
+    srn.is_worker = false;
+
+    srn.beam_hyps = NULL;
+    srn.beam_costs = NULL;
   }
 
   void searn_finish(searn& srn)
@@ -1924,6 +2339,7 @@ void print_update(vw& all, searn& srn)
 
     clear_snapshot(*all, srn, true);
     srn.snapshot_data.delete_v();
+    srn.snapshot_arena.delete_v();
 
     for (size_t i=0; i<srn.train_labels.size(); i++) {
       if (srn.rollout_all_actions) {
@@ -1958,6 +2374,31 @@ void print_update(vw& all, searn& srn)
 
     srn.beam_restore_to_end.delete_v();
     srn.beam_final_action_sequence.delete_v();
+    if (srn.beam_hyps != NULL) {
+      srn.beam_hyps->delete_pool(free_beam_hyp);
+      srn.beam_costs->delete_pool();
+      delete srn.beam_hyps;
+      delete srn.beam_costs;
+    }
+
+    for (rollout_worker** w = srn.workers.begin; w != srn.workers.end; w++) {
+      ((COST_SENSITIVE::label*)(*w)->srn->valid_labels)->costs.delete_v();
+      delete (COST_SENSITIVE::label*)(*w)->srn->valid_labels;
+      (*w)->srn->rollout_action.delete_v();
+      free_history_free_scores(*(*w)->srn);
+      free((*w)->srn);
+      free_sequence_copy(**w);
+      (*w)->ec_ptrs.delete_v();
+      delete *w;
+    }
+    srn.workers.delete_v();
+    srn.rollouts.delete_v();
+    free_history_free_scores(srn);
+    srn.lattice.cost.delete_v();
+    srn.lattice.next_cost.delete_v();
+    srn.lattice.transition.delete_v();
+    srn.lattice.through.delete_v();
+    srn.lattice.back.delete_v();
   }
 
   void ensure_param(float &v, float lo, float hi, float def, const char* string) {
@@ -2107,7 +2548,9 @@ void print_update(vw& all, searn& srn)
       ("searn_neighbor_features", po::value<string>(), "copy features from neighboring lines. argument looks like: '-1:a,+2' meaning copy previous line namespace a and next next line from namespace _unnamed_, where ',' separates them")
       ("searn_exploration_temperature", po::value<float>(), "if <0, always choose policy action (default); if T>=0, choose according to e^{-prediction / T} -- done to avoid overfitting")
       ("searn_beam", po::value<size_t>(), "size of beam -- currently only usable in test mode, not for learning")
-      ("searn_kbest", po::value<size_t>(), "return kbest lists -- currently only usable in test mode, requires beam >= kbest size");
+      ("searn_kbest", po::value<size_t>(), "return kbest lists -- currently only usable in test mode, requires beam >= kbest size")
+      ("searn_viterbi", "decode exactly by dynamic programming -- only usable in test mode, for tasks like sequence with --searn_history 1")
+      ("searn_rollout_threads", po::value<size_t>(), "do the rollouts of an example on this many threads, all against the weights from before it is learned (0, the default, interleaves rollouts and learning)");
     
     po::options_description add_desc_file("Searn options only available in regressor file");
     add_desc_file.add_options()("searn_trained_nb_policies", po::value<size_t>(), "the number of trained policies in the regressor file");
@@ -2169,10 +2612,25 @@ void print_update(vw& all, searn& srn)
       cerr << "error: beam>0 requires snapshotting and fastforwarding" << endl;
       throw exception();
     }
+    if (vm.count("searn_viterbi")) {
+      if (all.training) {
+        cerr << "error: cannot currently train with --searn_viterbi" << endl;
+        throw exception();
+      }
+      if (srn->beam_size > 0) {
+        cerr << "error: --searn_viterbi and --searn_beam are exclusive" << endl;
+        throw exception();
+      }
+      srn->viterbi = true;
+    }
     if ((srn->kbest > 1) && (srn->kbest < srn->beam_size)) {
       cerr << "error: kbest must be at least equal to beam_size" << endl;
       throw exception();
     }
+    if (srn->beam_size > 0) {
+      srn->beam_hyps  = new Beam::pool<beam_hyp>();
+      srn->beam_costs = new Beam::pool<float>();
+    }
 
     //check if the base learner is contextual bandit, in which case, we dont rollout all actions.
     if (vm.count("cb") || vm_file.count("cb")) {
@@ -2272,6 +2730,47 @@ void print_update(vw& all, searn& srn)
       srn->hinfo.bigram_features = false;
     }
 
+    if (vm.count("searn_rollout_threads")) {
+      srn->rollout_threads = vm["searn_rollout_threads"].as<size_t>();
+      if ((srn->rollout_threads > 0) &&
+          (srn->is_ldf || !srn->examples_dont_change || (srn->task_data != NULL) || // the task keeps state of its own
+           !srn->rollout_all_actions || (srn->exploration_temperature > 0.) || all.audit)) {
+        cerr << "warning: --searn_rollout_threads needs a non-ldf task without task data, a cost-sensitive base learner and no exploration or audit; interleaving rollouts and learning" << endl;
+        srn->rollout_threads = 0;
+      }
+    }
+
+    // history-free scores need csoaa right on gd, which mustn't truncate, and
+    // history features only in their own namespace
+    srn->history_free.enabled = srn->auto_history && !srn->is_ldf && srn->rollout_all_actions && srn->examples_dont_change &&
+      (all.cost_sensitive == all.l) && (vm.count("csoaa") || vm_file.count("csoaa")) &&
+      ((all.reg_mode % 2) == 0) && !all.audit && !all.hash_inv;
+    const char* below_csoaa[] = { "nn", "new_mf", "autolink", "lrq", "oaa", "ect", "bfgs", "conjugate_gradient" };
+    for (size_t i=0; i<sizeof(below_csoaa)/sizeof(below_csoaa[0]); i++)
+      if (vm.count(below_csoaa[i]) || vm_file.count(below_csoaa[i])) srn->history_free.enabled = false;
+    for (vector<string>::iterator i = all.pairs.begin(); i != all.pairs.end(); i++)
+      if (i->find((char)history_namespace) != string::npos) srn->history_free.enabled = false;
+    for (vector<string>::iterator i = all.triples.begin(); i != all.triples.end(); i++)
+      if (i->find((char)history_namespace) != string::npos) srn->history_free.enabled = false;
+    init_history_free_scores(*srn);
+
+    if (srn->viterbi && (!srn->one_prediction_per_example || !srn->auto_hamming_loss || (srn->hinfo.length != 1) || !srn->history_free.enabled)) {
+      cerr << "warning: --searn_viterbi needs a task like sequence with --searn_history 1 and csoaa directly on gd; predicting greedily" << endl;
+      srn->viterbi = false;
+    }
+
+    for (size_t i=0; i<srn->rollout_threads; i++) {
+      rollout_worker* w = new rollout_worker();
+      w->srn = (searn*)calloc_or_die(1, sizeof(searn));
+      w->srn->is_worker = true;
+      w->srn->valid_labels = new COST_SENSITIVE::label();
+      w->srn->A = srn->A;
+      init_history_free_scores(*w->srn);
+      w->main = srn;
+      w->id = i;
+      srn->workers.push_back(w);
+    }
+
     // set up copied examples if we need them
     if (! srn->examples_dont_change) {
       size_t label_size = srn->is_ldf ? sizeof(COST_SENSITIVE::label) : sizeof(MULTICLASS::mc_label);
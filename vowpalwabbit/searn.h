@@ -11,6 +11,7 @@ license as described in the file LICENSE.
 #include "parse_primitives.h"
 #include "v_hashmap.h"
 #include "cost_sensitive.h"
+#include "beam.h"
 #include <time.h>
 
 #define clog_print_audit_features(ec,reg) { print_audit_features(reg, ec); }
@@ -35,7 +36,7 @@ namespace Searn {
   void* calloc_or_die(size_t, size_t);
   void free_it(void*);
 
-  int  random_policy(uint64_t, float, bool, int, bool, bool);
+  int  random_policy(uint64_t, float, bool, int, bool, bool, bool global_seed=true);
 
   void add_history_to_example(vw&, history_info&, example*, history, size_t);
   void remove_history_from_example(vw&, history_info&, example*);
@@ -43,11 +44,41 @@ namespace Searn {
   struct snapshot_item {
     size_t index;
     size_t tag;
-    void  *data_ptr;
-    size_t data_size;  // sizeof(data_ptr)
-    size_t pred_step;  // srn->t when snapshot is made
+    size_t data_offset; // where the data is in snapshot_arena
+    size_t data_size;   // sizeof the data
+    size_t pred_step;   // srn->t when snapshot is made
   };
 
+  struct rollout {
+    size_t tid;        // which of the training timesteps this is
+    size_t t;          // the time step at which we vary the action
+    uint32_t a;        //   and the action we vary it to
+    float  loss;       // total loss of the rolled out trajectory
+    size_t ec_index;   // which example was predicted at t, or -1 if none
+  };
+
+  struct static_scores {
+    bool   enabled;          // csoaa directly on gd, history only in its own namespace
+    size_t first_example;    // example_counter of the first example of the sequence
+    size_t len;              // examples in the sequence, 0 if they can't be cached
+    size_t policies;         // policies that may be asked for in this sequence
+    size_t stamp;            // last stamp handed out
+    size_t sequence_stamp;   // scores of older policies are valid for the whole sequence,
+    size_t learn_stamp;      //   those of the current one until it is next learned
+    v_array<size_t> stamps;  // per (example, policy): the stamp its scores were computed under
+    v_array<float>  scores;  // per (example, policy, action): the score without history features
+    COST_SENSITIVE::label all_actions;
+  };
+
+  struct viterbi_lattice {
+    v_array<float>    cost;        // per action: cost of the cheapest path through the examples so far that ends in it
+    v_array<float>    next_cost;   //   and through the next example
+    v_array<float>    transition;  // per (action, previous action): what the history features add to its score
+    v_array<float>    through;     // per previous action: cost of the path through it to the action at hand
+    v_array<uint32_t> back;        // per (example, action): the previous action on its cheapest path, 0 at the start
+  };
+
+  struct rollout_worker;
   struct searn_task;
 
   struct beam_hyp {
@@ -66,30 +97,30 @@ namespace Searn {
     // functions that you will call
 
     inline uint32_t predict(example* ecs, size_t ec_len, v_array<uint32_t>* yallowed, v_array<uint32_t>* ystar) // for LDF
-    { return this->predict_f(*this->all, *this->base_learner, ecs, ec_len, yallowed, ystar, false); }
+    { return this->predict_f(*this, *this->base_learner, ecs, ec_len, yallowed, ystar, false); }
 
     inline uint32_t predict(example* ecs, size_t ec_len, v_array<uint32_t>* yallowed, uint32_t one_ystar) // for LDF
     { if (one_ystar == (uint32_t)-1) // test example
-        return this->predict_f(*this->all, *this->base_learner, ecs, ec_len, yallowed, NULL, false);
+        return this->predict_f(*this, *this->base_learner, ecs, ec_len, yallowed, NULL, false);
       else
-        return this->predict_f(*this->all, *this->base_learner, ecs, ec_len, yallowed, (v_array<uint32_t>*)&one_ystar, true);
+        return this->predict_f(*this, *this->base_learner, ecs, ec_len, yallowed, (v_array<uint32_t>*)&one_ystar, true);
     }
 
     inline uint32_t predict(example* ec, v_array<uint32_t>* yallowed, v_array<uint32_t>* ystar) // for not LDF
-    { return this->predict_f(*this->all, *this->base_learner, ec, 0, yallowed, ystar, false); }
+    { return this->predict_f(*this, *this->base_learner, ec, 0, yallowed, ystar, false); }
 
     inline uint32_t predict(example* ec, v_array<uint32_t>* yallowed, uint32_t one_ystar) // for not LDF
     { if (one_ystar == (uint32_t)-1) // test example
-        return this->predict_f(*this->all, *this->base_learner, ec, 0, yallowed, NULL, false);
+        return this->predict_f(*this, *this->base_learner, ec, 0, yallowed, NULL, false);
       else
-        return this->predict_f(*this->all, *this->base_learner, ec, 0, yallowed, (v_array<uint32_t>*)&one_ystar, true);
+        return this->predict_f(*this, *this->base_learner, ec, 0, yallowed, (v_array<uint32_t>*)&one_ystar, true);
     }
     
     inline void     declare_loss(size_t predictions_since_last, float incr_loss)
-    { return this->declare_loss_f(*this->all, predictions_since_last, incr_loss); }
+    { return this->declare_loss_f(*this, predictions_since_last, incr_loss); }
 
     inline void     snapshot(size_t index, size_t tag, void* data_ptr, size_t sizeof_data, bool used_for_prediction)
-    { return this->snapshot_f(*this->all, index, tag, data_ptr, sizeof_data, used_for_prediction); }
+    { return this->snapshot_f(*this, index, tag, data_ptr, sizeof_data, used_for_prediction); }
 
     // structure that you must set, and any associated data you want to store
     searn_task* task;
@@ -98,11 +129,12 @@ namespace Searn {
     bool auto_hamming_loss;     // if you're just optimizing hamming loss, we can do it for you!
     bool examples_dont_change;  // set to true if you don't do any internal example munging
     bool is_ldf;                // set to true if you'll generate LDF data
+    bool one_prediction_per_example; // set to true if you predict each example once, in order, over all actions, and output just the predictions
 
     // data that you should not look at.  ever.
-    uint32_t (*predict_f)(vw&, LEARNER::learner&,example*,size_t,v_array<uint32_t>*,v_array<uint32_t>*,bool);
-    void     (*declare_loss_f)(vw&,size_t,float);   // <0 means it was a test example!
-    void     (*snapshot_f)(vw&,size_t,size_t,void*,size_t,bool);
+    uint32_t (*predict_f)(searn&, LEARNER::learner&,example*,size_t,v_array<uint32_t>*,v_array<uint32_t>*,bool);
+    void     (*declare_loss_f)(searn&,size_t,float);   // <0 means it was a test example!
+    void     (*snapshot_f)(searn&,size_t,size_t,void*,size_t,bool);
     
     size_t A;             // total number of actions, [1..A]; 0 means ldf
     char state;           // current state of learning
@@ -112,6 +144,7 @@ namespace Searn {
     bool snapshot_could_match;
     size_t snapshot_last_found_pos;
     v_array<snapshot_item> snapshot_data;
+    v_array<char> snapshot_arena; // the data of all snapshots of the current sequence, reset between sequences
     v_array<uint32_t> train_action;  // which actions did we actually take in the train (or test) pass?
     v_array<uint32_t> train_action_ids;  // these are the ids -- the same in non-ldf mode, but the index in ldf mode (while train_action is id.weight_index)
     v_array< void* > train_labels;  // which labels are valid at any given time
@@ -123,6 +156,8 @@ namespace Searn {
     beam_hyp * cur_beam_hyp;
     v_array<snapshot_item> beam_restore_to_end;
     v_array<uint32_t> beam_final_action_sequence;
+    Beam::pool<beam_hyp>* beam_hyps;  // the hypotheses of the current sequence,
+    Beam::pool<float>* beam_costs;    //   and their action costs
     
     bool should_produce_string;
     stringstream *pred_string;
@@ -177,6 +212,16 @@ namespace Searn {
     clock_t start_clock_time;
     
     example*empty_example;
+
+    size_t rollout_threads;           // 0 means interleave rollouts with learning, one timestep at a time
+    v_array<rollout_worker*> workers; // one searn state each, for rolling out in parallel
+    v_array<rollout> rollouts;        // the (timestep, action) pairs of the current example
+    bool is_worker;                   // is this a worker's copy of the state?
+
+    static_scores history_free;       // per-example scores that the history features are added to
+
+    bool viterbi;                     // decode exactly, when predictions see just the previous action
+    viterbi_lattice lattice;
   };
 
   template<class T> void check_option(T& ret, vw&all, po::variables_map& vm, po::variables_map& vm_file, const char* opt_name, bool default_to_cmdline, bool(*equal)(T,T), const char* mismatch_error_string, const char* required_error_string);
@@ -16,6 +16,7 @@ namespace SequenceTask {
     srn.auto_history         = true;  // automatically add history features to our examples, please
     srn.auto_hamming_loss    = true;  // please just use hamming loss on individual predictions -- we won't declare_loss
     srn.examples_dont_change = true;  // we don't do any internal example munging
+    srn.one_prediction_per_example = true;  // so we can be decoded exactly with --searn_viterbi
   }
 
   void finish(searn& srn) { }    // if we had task data, we'd want to free it here
@@ -15,3 +15,46 @@ void sd_offset_update(weight* weights, size_t mask, feature* begin, feature* end
     weights[(f->weight_index + offset) & mask] += update * f->x - regularization * weights[(f->weight_index + offset) & mask];
 } 
 
+
+// unless the factors of a feature wrap around the end of the weight vector
+// the rank loops below are strided axpys, which the compiler vectorizes
+void sd_offset_rank_add(weight* weights, size_t mask, feature* begin, feature* end, size_t offset, size_t increment, size_t rank, float* sums)
+{
+  size_t span = (rank-1) * increment;
+  for (feature* f = begin; f != end; f++)
+    {
+      size_t first = (f->weight_index + offset) & mask;
+      float x = f->x;
+      if (first + span <= mask)
+	{
+	  weight* w = weights + first;
+	  for (size_t k = 0; k < rank; k++)
+	    sums[k] += x * w[k*increment];
+	}
+      else
+	for (size_t k = 0; k < rank; k++)
+	  sums[k] += x * weights[(first + k*increment) & mask];
+    }
+}
+
+void sd_offset_rank_update(weight* weights, size_t mask, feature* begin, feature* end, size_t offset, size_t increment, size_t rank, const float* update, float regularization)
+{
+  size_t span = (rank-1) * increment;
+  for (feature* f = begin; f != end; f++)
+    {
+      size_t first = (f->weight_index + offset) & mask;
+      float x = f->x;
+      if (first + span <= mask)
+	{
+	  weight* w = weights + first;
+	  for (size_t k = 0; k < rank; k++)
+	    w[k*increment] += update[k] * x - regularization * w[k*increment];
+	}
+      else
+	for (size_t k = 0; k < rank; k++)
+	  {
+	    weight& w = weights[(first + k*increment) & mask];
+	    w += update[k] * x - regularization * w;
+	  }
+    }
+}
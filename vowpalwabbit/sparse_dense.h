@@ -95,4 +95,12 @@ inline void vec_add_trunc_rescale_general(predict_data<gnp>& p, const float fx,
 
 void sd_offset_update(weight* weights, size_t mask, feature* begin, feature* end, size_t offset, float update, float regularization);
 
+// factorization kernels: the rank factors of a feature sit at offset,
+// offset+increment, ..., offset+(rank-1)*increment from its weight index.
+// sums[k] += x * factor k over all features, in one sweep of the features
+void sd_offset_rank_add(weight* weights, size_t mask, feature* begin, feature* end, size_t offset, size_t increment, size_t rank, float* sums);
+
+// factor k += update[k] * x - regularization * factor k, in one sweep
+void sd_offset_rank_update(weight* weights, size_t mask, feature* begin, feature* end, size_t offset, size_t increment, size_t rank, const float* update, float regularization);
+
 #endif
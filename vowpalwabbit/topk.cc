@@ -7,9 +7,6 @@ license as described in the file LICENSE.
 #include <math.h>
 #include <stdio.h>
 #include <sstream>
-#include <numeric>
-#include <vector>
-#include <queue>
 
 #include "topk.h"
 #include "cache.h"
@@ -19,68 +16,187 @@ license as described in the file LICENSE.
 using namespace std;
 using namespace LEARNER;
 
-typedef pair<float, v_array<char> > scored_example;
+namespace TOPK {
 
-struct compare_scored_examples
-{
-    bool operator()(scored_example const& a, scored_example const& b) const
-    {
-        return a.first > b.first;
-    }
-};
+  // a candidate in a group's heap.  the tag bytes live in the group's arena
+  struct scored_tag {
+    float score;
+    uint32_t tag_len;
+    size_t tag_offset;
+  };
 
-namespace TOPK {
+  struct group {
+    v_array<char> key;          // query id this group was created for
+    v_array<scored_tag> heap;   // min-heap on score, capacity B reserved up front
+    v_array<char> arena;        // tag bytes of heap entries, append only until compacted
+    size_t live_bytes;          // bytes of arena still referenced from heap
+  };
 
   struct topk{
     uint32_t B; //rec number
-    priority_queue<scored_example, vector<scored_example>, compare_scored_examples > pr_queue;
+    bool grouped;
+    char group_sep;             // the query id is the prefix of the tag up to group_sep
+    v_array<group*> groups;     // in order of first appearance; reused across flushes
+    size_t active_groups;
+    v_hashmap<substring, size_t>* group_index;
+    v_array<char> scratch;      // spare arena for compaction
     vw* all;
   };
 
-  void print_result(int f, priority_queue<scored_example, vector<scored_example>, compare_scored_examples > &pr_queue)
+  bool substring_eq(substring a, substring b) {
+    size_t len = a.end - a.begin;
+    return (len == (size_t)(b.end - b.begin)) && (memcmp(a.begin, b.begin, len) == 0);
+  }
+
+  inline size_t hash_key(substring s) { return uniform_hash((unsigned char*)s.begin, s.end - s.begin, 0); }
+
+  void sift_down(v_array<scored_tag>& heap, size_t n, size_t i)
+  {
+    while (true) {
+      size_t smallest = i, l = 2*i+1, r = 2*i+2;
+      if (l < n && heap[l].score < heap[smallest].score) smallest = l;
+      if (r < n && heap[r].score < heap[smallest].score) smallest = r;
+      if (smallest == i) return;
+      scored_tag tmp = heap[i]; heap[i] = heap[smallest]; heap[smallest] = tmp;
+      i = smallest;
+    }
+  }
+
+  void sift_up(v_array<scored_tag>& heap, size_t i)
+  {
+    while (i > 0) {
+      size_t parent = (i-1) / 2;
+      if (!(heap[i].score < heap[parent].score)) return;
+      scored_tag tmp = heap[i]; heap[i] = heap[parent]; heap[parent] = tmp;
+      i = parent;
+    }
+  }
+
+  // once more than half of the arena is dead, copy the live tags into the
+  // scratch arena and swap the two; both keep their capacity
+  void compact_arena(topk& d, group& g)
+  {
+    if (g.arena.size() < 4096 || g.arena.size() < 2 * g.live_bytes) return;
+    d.scratch.erase();
+    for (scored_tag* s = g.heap.begin; s != g.heap.end; s++) {
+      size_t offset = d.scratch.size();
+      push_many(d.scratch, g.arena.begin + s->tag_offset, s->tag_len);
+      s->tag_offset = offset;
+    }
+    v_array<char> tmp = g.arena;
+    g.arena = d.scratch;
+    d.scratch = tmp;
+  }
+
+  void push_candidate(topk& d, group& g, float score, char* tag, size_t tag_len)
+  {
+    if (g.heap.size() >= d.B) {
+      if (d.B == 0 || g.heap[0].score >= score) return;
+      g.live_bytes -= g.heap[0].tag_len;
+      g.heap[0] = g.heap.last();
+      g.heap.decr();
+      sift_down(g.heap, g.heap.size(), 0);
+      compact_arena(d, g);
+    }
+    scored_tag s = { score, (uint32_t)tag_len, g.arena.size() };
+    push_many(g.arena, tag, tag_len);
+    g.live_bytes += tag_len;
+    g.heap.push_back(s);
+    sift_up(g.heap, g.heap.size()-1);
+  }
+
+  group& find_group(topk& d, example& ec)
   {
-    if (f >= 0)
-    {
-      char temp[30];
-      std::stringstream ss;
-      scored_example tmp_example;
-      while(!pr_queue.empty())
-      {
-        tmp_example = pr_queue.top(); 
-        pr_queue.pop();       
-        sprintf(temp, "%f", tmp_example.first);
-        ss << temp;
-        ss << ' ';
-        print_tag(ss, tmp_example.second);
-        ss << ' ';
-        ss << '\n';      
+    if (!d.grouped) {
+      d.active_groups = 1;
+      return *d.groups[0];
+    }
+
+    substring key = { ec.tag.begin, ec.tag.end };
+    for (char* c = ec.tag.begin; c != ec.tag.end; c++)
+      if (*c == d.group_sep) { key.end = c; break; }
+
+    size_t h = hash_key(key);
+    size_t idx = d.group_index->get(key, h);
+    if (idx != (size_t)-1) return *d.groups[idx];
+
+    if (d.active_groups == d.groups.size()) {
+      group* g = new group();
+      g->heap.resize(d.B);
+      d.groups.push_back(g);
+    }
+    group& g = *d.groups[d.active_groups];
+    g.key.erase();
+    push_many(g.key, key.begin, key.end - key.begin);
+    substring stored = { g.key.begin, g.key.end };
+    d.group_index->put(stored, h, d.active_groups);
+    d.active_groups++;
+    return g;
+  }
+
+  // writes every active group, each in ascending score order, then resets them
+  void flush(vw& all, topk& d)
+  {
+    std::stringstream ss;
+    bool any = false;
+    for (size_t k = 0; k < d.active_groups; k++) {
+      group& g = *d.groups[k];
+      if (g.heap.size() == 0 && d.grouped) continue;
+      any = true;
+
+      // popping the min-heap yields the candidates in ascending score order
+      for (size_t n = g.heap.size(); n > 0; n--) {
+        scored_tag s = g.heap[0];
+        char temp[30];
+        sprintf(temp, "%f", s.score);
+        ss << temp << ' ';
+        if (s.tag_len > 0) {
+          ss << ' ';
+          ss.write(g.arena.begin + s.tag_offset, s.tag_len);
+        }
+        ss << ' ' << '\n';
+        g.heap[0] = g.heap[n-1];
+        sift_down(g.heap, n-1, 0);
       }
-      ss << '\n';        
-      ssize_t len = ss.str().size();
+      ss << '\n';
+
+      g.heap.erase();
+      g.arena.erase();
+      g.live_bytes = 0;
+    }
+
+    if (d.grouped) {
+      d.group_index->clear();
+      d.active_groups = 0;
+    }
+
+    if (!any) return;
+    string out = ss.str();
+    ssize_t len = out.size();
+    for (int* sink = all.final_prediction_sink.begin; sink != all.final_prediction_sink.end; sink++) {
 #ifdef _WIN32
-	  ssize_t t = _write(f, ss.str().c_str(), (unsigned int)len);
+      ssize_t t = _write(*sink, out.c_str(), (unsigned int)len);
 #else
-	  ssize_t t = write(f, ss.str().c_str(), (unsigned int)len);
+      ssize_t t = write(*sink, out.c_str(), (unsigned int)len);
 #endif
       if (t != len)
         cerr << "write error" << endl;
-    }    
+    }
   }
 
   void output_example(vw& all, topk& d, example& ec)
   {
     label_data* ld = (label_data*)ec.ld;
-    
+
     all.sd->weighted_examples += ld->weight;
     all.sd->sum_loss += ec.loss;
     all.sd->sum_loss_since_last_dump += ec.loss;
     all.sd->total_features += ec.num_features;
     all.sd->example_number++;
- 
+
     if (example_is_newline(ec))
-      for (int* sink = all.final_prediction_sink.begin; sink != all.final_prediction_sink.end; sink++)
-        TOPK::print_result(*sink, d.pr_queue);
-       
+      flush(all, d);
+
     print_update(all, ec);
   }
 
@@ -94,15 +210,8 @@ namespace TOPK {
     else
       base.predict(ec);
 
-    if(d.pr_queue.size() < d.B)      
-      d.pr_queue.push(make_pair(ec.final_prediction, ec.tag));
-
-    else if(d.pr_queue.top().first < ec.final_prediction)
-    {
-      d.pr_queue.pop();
-      d.pr_queue.push(make_pair(ec.final_prediction, ec.tag));
-    }
-
+    group& g = find_group(d, ec);
+    push_candidate(d, g, ec.final_prediction, ec.tag.begin, ec.tag.size());
   }
 
   void finish_example(vw& all, topk& d, example& ec)
@@ -111,18 +220,63 @@ namespace TOPK {
     VW::finish_example(all, &ec);
   }
 
+  void end_examples(topk& d)
+  { // input that does not end in a newline still gets its results
+    bool pending = false;
+    for (size_t k = 0; k < d.active_groups; k++)
+      if (d.groups[k]->heap.size() > 0) pending = true;
+    if (pending)
+      flush(*d.all, d);
+  }
+
+  void finish(topk& d)
+  {
+    for (group** g = d.groups.begin; g != d.groups.end; g++) {
+      (*g)->key.delete_v();
+      (*g)->heap.delete_v();
+      (*g)->arena.delete_v();
+      delete *g;
+    }
+    d.groups.delete_v();
+    d.scratch.delete_v();
+    delete d.group_index;
+  }
+
   learner* setup(vw& all, std::vector<std::string>&opts, po::variables_map& vm, po::variables_map& vm_file)
   {
     topk* data = (topk*)calloc(1, sizeof(topk));
 
     data->B = (uint32_t)vm["top"].as<size_t>();
 
+    po::options_description desc("TOP K options");
+    desc.add_options()
+      ("top_group_sep", po::value<char>(), "group candidates by the tag prefix before this character and report top k per group");
+    po::parsed_options parsed = po::command_line_parser(opts).
+      style(po::command_line_style::default_style ^ po::command_line_style::allow_guessing).
+      options(desc).allow_unregistered().run();
+    opts = po::collect_unrecognized(parsed.options, po::include_positional);
+    po::store(parsed, vm);
+    po::notify(vm);
+
+    if (vm.count("top_group_sep")) {
+      data->grouped = true;
+      data->group_sep = vm["top_group_sep"].as<char>();
+    }
+    data->group_index = new v_hashmap<substring, size_t>(1023, (size_t)-1, substring_eq);
+
+    group* g = new group();
+    g->heap.resize(data->B);
+    data->groups.push_back(g);
+    data->active_groups = data->grouped ? 0 : 1;
+
     data->all = &all;
 
     learner* l = new learner(data, all.l);
     l->set_learn<topk, predict_or_learn<true> >();
     l->set_predict<topk, predict_or_learn<false> >();
     l->set_finish_example<topk,finish_example>();
+    l->set_end_examples<topk,end_examples>();
+    l->set_finish<topk,finish>();
 
     return l;
   }
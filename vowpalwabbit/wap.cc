@@ -19,10 +19,13 @@ using namespace LEARNER;
 
 namespace WAP {
   struct wap{
-    size_t increment; //wap does funky things with the increment, so we keep explicit access
+    bool mirror; //the base reads features itself, so it can't learn a difference of problems
     vw* all;
   };
   
+  //the pair (i,j) as a binary problem on mirrored features: those at offset1
+  //plus negated copies at offset2.  Only for bases that don't go through
+  //GD::foreach_feature, which handles difference_offset instead.
   void mirror_features(vw& all, example& ec, uint32_t offset1, uint32_t offset2)
   {
     for (unsigned char* i = ec.indices.begin; i != ec.indices.end; i++) 
@@ -178,11 +181,21 @@ namespace WAP {
               ec.partial_prediction = 0.;
               uint32_t myi = (uint32_t)vs[i].ci.weight_index;
               uint32_t myj = (uint32_t)vs[j].ci.weight_index;
+              uint32_t offset_i = (uint32_t)((myi-1)*base.increment);
+              uint32_t offset_j = (uint32_t)((myj-1)*base.increment);
 
-              mirror_features(all, ec, (uint32_t)((myi-1)*w.increment), (uint32_t)((myj-1)*w.increment));
-
-              base.learn(ec);
-              unmirror_features(all, ec, (uint32_t)((myi-1)*w.increment), (uint32_t)((myj-1)*w.increment));
+              if (w.mirror)
+                {
+                  mirror_features(all, ec, offset_i, offset_j);
+                  base.learn(ec);
+                  unmirror_features(all, ec, offset_i, offset_j);
+                }
+              else
+                {
+                  ec.difference_offset = offset_j - offset_i;
+                  base.learn(ec, myi-1);
+                  ec.difference_offset = 0;
+                }
             }
         }
 
@@ -259,11 +272,12 @@ namespace WAP {
 
     all.sd->k = (uint32_t)nb_actions;
 
+    w->mirror = all.l->reads_features;
+
     learner* l = new learner(w, all.l, nb_actions);
     l->set_learn<wap, predict_or_learn<true> >();
     l->set_predict<wap, predict_or_learn<false> >();
     l->set_finish_example<wap,finish_example>();
-    w->increment = l->increment;
 
     return l;
   }